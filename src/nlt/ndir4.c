@@ -0,0 +1,135 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "ndir4.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Initial second-level block allocation count,
+//   must be power of two due to alloc code,
+static const unsigned ND_BLOCKS_INIT = 64;
+
+static unsigned ndir4_add_block(ndir4_t* dir) {
+    assert(dir);
+    if(dir->nblocks == dir->alloc) {
+        dir->alloc <<= 1;
+        dir->blocks = realloc(dir->blocks, dir->alloc * 256 * sizeof(uint32_t));
+    }
+    const unsigned rv = dir->nblocks++;
+    assert(rv < (1U << 23));
+    return rv;
+}
+
+// Note levels are referenced by block index rather than pointer, because
+//   ndir4_add_block() can move the block storage.  blk < 0 means l1.
+static inline uint32_t* ndir4_level(const ndir4_t* dir, const int blk) {
+    return blk < 0 ? dir->l1 : &dir->blocks[(unsigned)blk << 8];
+}
+
+// Fill the entries of level "blk" covered by the ntree branch "ref", which
+//   sits at "depth" bits below the v4 root.  "slot" is the first level entry
+//   the branch covers, and "lvl_end" is the depth at which this level ends.
+static void ndir4_fill(ndir4_t* dir, const ntree_t* tree, const uint32_t ref, const unsigned depth, const int blk, const unsigned slot, const unsigned lvl_end) {
+    assert(dir); assert(tree);
+    assert(depth <= lvl_end);
+    assert(lvl_end <= 32);
+
+    if(NN_IS_DCLIST(ref)) {
+        uint32_t* level = ndir4_level(dir, blk);
+        const unsigned span = 1U << (lvl_end - depth);
+        for(unsigned i = 0; i < span; i++)
+            level[slot + i] = ref;
+    }
+    else if(depth == lvl_end) {
+        // deeper than this level, hang a new block for the next 8 bits
+        assert(lvl_end < 32);
+        const unsigned nb = ndir4_add_block(dir);
+        ndir4_level(dir, blk)[slot] = nb;
+        ndir4_fill(dir, tree, ref, depth, (int)nb, 0, depth + 8);
+    }
+    else {
+        assert(ref < tree->count);
+        const nnode_t* node = &tree->store[ref];
+        const unsigned half = 1U << (lvl_end - depth - 1);
+        ndir4_fill(dir, tree, node->zero, depth + 1, blk, slot, lvl_end);
+        ndir4_fill(dir, tree, node->one, depth + 1, blk, slot + half, lvl_end);
+    }
+}
+
+ndir4_t* ndir4_new(const ntree_t* tree, const unsigned l1_bits) {
+    assert(tree);
+    assert(!tree->alloc); // ntree_finish() was called
+    assert(l1_bits == 16 || l1_bits == 24);
+
+    ndir4_t* dir = malloc(sizeof(ndir4_t));
+    dir->l1_bits = l1_bits;
+    dir->l1 = malloc((1U << l1_bits) * sizeof(uint32_t));
+    dir->nblocks = 0;
+    dir->alloc = ND_BLOCKS_INIT;
+    dir->blocks = malloc(dir->alloc * 256 * sizeof(uint32_t));
+
+    ndir4_fill(dir, tree, tree->ipv4, 0, -1, 0, l1_bits);
+
+    // trim excess block storage
+    dir->alloc = 0;
+    if(dir->nblocks) {
+        dir->blocks = realloc(dir->blocks, dir->nblocks * 256 * sizeof(uint32_t));
+    }
+    else {
+        free(dir->blocks);
+        dir->blocks = NULL;
+    }
+
+    return dir;
+}
+
+void ndir4_destroy(ndir4_t* dir) {
+    assert(dir);
+    free(dir->l1);
+    free(dir->blocks);
+    free(dir);
+}
+
+size_t ndir4_size(const ndir4_t* dir) {
+    assert(dir);
+    return sizeof(ndir4_t)
+        + ((size_t)1 << dir->l1_bits) * sizeof(uint32_t)
+        + (size_t)dir->nblocks * 256 * sizeof(uint32_t);
+}
+
+unsigned ndir4_lookup(const ndir4_t* dir, const uint32_t ipv4) {
+    assert(dir);
+    assert(!dir->alloc); // construction finished
+
+    unsigned shift = 32 - dir->l1_bits;
+    uint32_t entry = dir->l1[ipv4 >> shift];
+    while(!NN_IS_DCLIST(entry)) {
+        assert(shift >= 8);
+        assert(entry < dir->nblocks);
+        shift -= 8;
+        entry = dir->blocks[(entry << 8) | ((ipv4 >> shift) & 0xFF)];
+    }
+
+    assert(entry != NN_UNDEF); // the special v4-like undefined areas
+    return NN_GET_DCLIST(entry);
+}
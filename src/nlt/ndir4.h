@@ -0,0 +1,56 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NDIR4_H
+#define NDIR4_H
+
+#include "config.h"
+#include <inttypes.h>
+#include "ntree.h"
+
+/*
+ * A DIR-24-8 style direct-indexed table for the IPv4 part of a finished
+ * ntree_t.  The first level is a flat array indexed by the top l1_bits
+ * of the address (16 or 24), and any longer prefixes hang off of it in
+ * 256-entry blocks, each consuming the next 8 bits.  Entries use the same
+ * encoding as nnode_t branches: if the MSB is set the rest is a dclist,
+ * otherwise the rest is a block index for the next 8 bits.  So a lookup
+ * is 1-3 memory accesses for l1_bits=16, and 1-2 for l1_bits=24.
+ */
+
+typedef struct {
+    uint32_t* l1;     // 1 << l1_bits entries
+    uint32_t* blocks; // 256 * nblocks entries
+    unsigned l1_bits;
+    unsigned nblocks;
+    unsigned alloc;   // blocks allocated during construction
+} ndir4_t;
+
+// tree must be finished already.  l1_bits must be 16 or 24.
+ndir4_t* ndir4_new(const ntree_t* tree, const unsigned l1_bits);
+
+void ndir4_destroy(ndir4_t* dir);
+
+// memory used by the table, in bytes
+size_t ndir4_size(const ndir4_t* dir);
+
+// ipv4 is in host byte order, returns the same as ntree_lookup_v4()
+unsigned ndir4_lookup(const ndir4_t* dir, const uint32_t ipv4);
+
+#endif // NDIR4_H
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #define NLIST_INITSIZE 64
 
@@ -35,7 +36,7 @@ struct _nlist {
     net_t* nets;
     unsigned alloc;
     unsigned count;
-    bool normalized;
+    bool finished; // sorted and free of duplicates, if not also merged
 };
 
 nlist_t* nlist_new(void) {
@@ -43,7 +44,7 @@ nlist_t* nlist_new(void) {
     nl->nets = malloc(sizeof(net_t) * NLIST_INITSIZE);
     nl->alloc = NLIST_INITSIZE;
     nl->count = 0;
-    nl->normalized = false;
+    nl->finished = false;
     return nl;
 }
 
@@ -139,52 +140,107 @@ static bool net_eq(const net_t* na, const net_t* nb) {
     return na->mask == nb->mask && !memcmp(na->ipv6, nb->ipv6, 16);
 }
 
-// do a single pass of forward-normalization
-//   on a sorted nlist, then sort the result.
+// Stable LSD radix sort of an array of net_t into net_sorter() order,
+//   one byte of the key per pass: the mask first, then the address from
+//   its last byte to its first.  All of the passes' histograms are taken
+//   in one read of the array up front, and a pass is skipped when every
+//   key has the same byte there (e.g. the host bytes of a list of /24s,
+//   or most of the v4compat prefix).  Stability makes exact duplicates
+//   keep their append order, as glibc's (merge sort) qsort() did.
+#define NET_KEY_BYTES 17U
+static unsigned net_key_byte(const net_t* n, const unsigned d) {
+    return d < 16U ? n->ipv6[d] : n->mask;
+}
+
+static void nets_sort(net_t* nets, const unsigned count) {
+    assert(nets); assert(count);
+
+    unsigned (*hist)[256] = calloc(NET_KEY_BYTES, sizeof(*hist));
+    for(unsigned i = 0; i < count; i++) {
+        assert(nets[i].mask < 129U);
+        for(unsigned d = 0; d < NET_KEY_BYTES; d++)
+            hist[d][net_key_byte(&nets[i], d)]++;
+    }
+
+    net_t* src = nets;
+    net_t* dst = NULL;
+    unsigned d = NET_KEY_BYTES;
+    while(d--) {
+        unsigned* h = hist[d];
+        if(h[net_key_byte(&src[0], d)] == count)
+            continue; // all the same, no reordering
+
+        unsigned offset = 0;
+        for(unsigned b = 0; b < 256U; b++) {
+            const unsigned c = h[b];
+            h[b] = offset;
+            offset += c;
+        }
+
+        if(!dst)
+            dst = malloc(count * sizeof(net_t));
+        for(unsigned i = 0; i < count; i++)
+            dst[h[net_key_byte(&src[i], d)]++] = src[i];
+
+        net_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if(src != nets) {
+        memcpy(nets, src, count * sizeof(net_t));
+        dst = src;
+    }
+    free(dst);
+    free(hist);
+}
+
+// do a single pass of forward-normalization on a sorted nlist, leaving
+//   it sorted.  Each surviving entry absorbs the run of entries after it
+//   which it duplicates, covers with the same dclist, or pairs with as an
+//   adjacent same-dclist sibling (shortening its own mask), and is then
+//   compacted down to the next free slot.  A shortened mask can sort
+//   before earlier survivors with the same address and longer masks, so
+//   each survivor is insertion-sorted into place as it's stored, which
+//   is one comparison for all but those.  This gives exactly the order
+//   that re-sorting the whole list with a stable sort would.
+//   Returns true if anything merged (and another pass is needed).
 static bool nlist_normalize_1pass(nlist_t* nl) {
     assert(nl); assert(nl->count);
 
-    bool rv = false;
-
+    net_t* nets = nl->nets;
     const unsigned oldcount = nl->count;
-    unsigned newcount = nl->count;
+    unsigned newcount = 0;
     unsigned i = 0;
     while(i < oldcount) {
-        net_t* na = &nl->nets[i];
+        net_t na = nets[i];
         unsigned j = i + 1;
         while(j < oldcount) {
-            net_t* nb = &nl->nets[j];
-            if(net_eq(na, nb)) { // net+mask match, dclist may or may not match
+            const net_t* nb = &nets[j];
+            if(net_eq(&na, nb)) { // net+mask match, dclist may or may not match
                 // fall-through past else - ugly, but easier for future upstream merges
             }
-            else if(mergeable_nets(na, nb)) { // dclists match, nets adjacent (masks equal) or subnet-of
-                if(na->mask == nb->mask)
-                    na->mask--;
+            else if(mergeable_nets(&na, nb)) { // dclists match, nets adjacent (masks equal) or subnet-of
+                if(na.mask == nb->mask)
+                    na.mask--;
             }
             else {
                 break;
             }
-            nb->mask = 0xFFFF; // illegally-huge, to sort deletes later
-            memset(nb->ipv6, 0xFF, 16); // all-1's, also for sort...
-            newcount--;
             j++;
         }
         i = j;
-    }
-
-    if(newcount != oldcount) { // merges happened above
-        // the "deleted" entries have all-1's IPs and >legal masks, so they
-        //   sort to the end...
-        qsort(nl->nets, oldcount, sizeof(net_t), net_sorter);
-
-        // reset the count to ignore the deleted entries at the end
-        nl->count = newcount;
 
-        // signal need for another pass
-        rv = true;
+        unsigned k = newcount++;
+        while(k && net_sorter(&nets[k - 1], &na) > 0) {
+            nets[k] = nets[k - 1];
+            k--;
+        }
+        nets[k] = na;
     }
 
-    return rv;
+    nl->count = newcount;
+    return newcount != oldcount;
 }
 
 static void nlist_normalize(nlist_t* nl, const bool post_merge) {
@@ -193,9 +249,11 @@ static void nlist_normalize(nlist_t* nl, const bool post_merge) {
     if(nl->count) {
         // initial sort, unless already sorted by the merge process
         if(!post_merge)
-            qsort(nl->nets, nl->count, sizeof(net_t), net_sorter);
+            nets_sort(nl->nets, nl->count);
 
-        // iterate merge+sort passes until no further merges are found
+        // iterate merge passes until no further merges are found.  Each
+        //   one is linear, and an aggregation-heavy list roughly halves
+        //   on every pass.
         while(nlist_normalize_1pass(nl))
             ; // empty
 
@@ -207,134 +265,728 @@ static void nlist_normalize(nlist_t* nl, const bool post_merge) {
         }
     }
 
-    nl->normalized = true;
+    nl->finished = true;
 }
 
 void nlist_finish(nlist_t* nl) {
     assert(nl);
-    if(!nl->normalized)
+    if(!nl->finished)
         nlist_normalize(nl, false);
 }
 
-static bool net_subnet_of(const net_t* sub, const net_t* super) {
-    assert(sub); assert(super);
-    assert(sub->mask < 129);
-    assert(super->mask < 129);
+void nlist_finish_unmerged(nlist_t* nl, const bool last_wins) {
+    assert(nl);
+    assert(!nl->finished);
 
-    bool rv = false;
-    if(sub->mask >= super->mask) {
-        const unsigned wbyte = (super->mask >> 3);
-        const unsigned byte_mask = (0xFF << (8 - (super->mask & 7))) & 0xFF;
-        if(!memcmp(sub->ipv6, super->ipv6, wbyte)) {
-            if(wbyte == 16 || (super->ipv6[wbyte] & byte_mask) == (sub->ipv6[wbyte] & byte_mask))
-                rv = true;
+    if(nl->count) {
+        nets_sort(nl->nets, nl->count);
+
+        // the stable sort leaves exact duplicates in append order
+        net_t* nets = nl->nets;
+        unsigned newcount = 1;
+        for(unsigned i = 1; i < nl->count; i++) {
+            if(!net_eq(&nets[newcount - 1], &nets[i]))
+                nets[newcount++] = nets[i];
+            else if(last_wins)
+                nets[newcount - 1] = nets[i];
+        }
+        nl->count = newcount;
+        if(nl->count != nl->alloc) {
+            nl->alloc = nl->count;
+            nl->nets = realloc(nl->nets, nl->alloc * sizeof(net_t));
         }
     }
 
-    return rv;
+    nl->finished = true;
+}
+
+unsigned nlist_count(const nlist_t* nl) {
+    assert(nl);
+    return nl->count;
+}
+
+// An address as two host-order 64-bit words, most significant first, so
+//   that the prefix tests in nlist_xlate_tree() are a couple of shifts
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} v6w_t;
+
+static v6w_t v6w_load(const uint8_t* ipv6) {
+    v6w_t w = { 0, 0 };
+    for(unsigned i = 0; i < 8U; i++) {
+        w.hi = (w.hi << 8) | ipv6[i];
+        w.lo = (w.lo << 8) | ipv6[i + 8U];
+    }
+    return w;
 }
 
-static unsigned nxt_rec(const net_t** nl, const net_t* const nl_end, ntree_t* nt, net_t tree_net);
+// bit is 0->127 (MSB -> LSB), as SETBIT_v6()
+static void v6w_setbit(v6w_t* w, const unsigned bit) {
+    assert(bit < 128U);
+    if(bit < 64U)
+        w->hi |= 1ULL << (63U - bit);
+    else
+        w->lo |= 1ULL << (127U - bit);
+}
+
+// true if the first "bits" bits of a and b match
+static bool v6w_prefix_eq(const v6w_t* a, const v6w_t* b, const unsigned bits) {
+    assert(bits < 129U);
+    if(bits <= 64U)
+        return !bits || !((a->hi ^ b->hi) >> (64U - bits));
+    return a->hi == b->hi && !((a->lo ^ b->lo) >> (128U - bits));
+}
 
-static void nxt_rec_dir(const net_t** nlp, const net_t* const nl_end, ntree_t* nt, net_t tree_net, const unsigned nt_idx, const bool direction) {
-    assert(nlp); assert(nl_end); assert(nt);
-    assert(tree_net.mask < 129 && tree_net.mask > 0);
+// Length of the common prefix of two addresses, in bits
+static unsigned v6w_common_bits(const v6w_t* a, const v6w_t* b) {
+    if(a->hi != b->hi)
+        return (unsigned)__builtin_clzll(a->hi ^ b->hi);
+    if(a->lo != b->lo)
+        return 64U + (unsigned)__builtin_clzll(a->lo ^ b->lo);
+    return 128U;
+}
+
+// The number of nodes the tree builder will add for the sorted nets
+//   "nets"/"count", before any are collapsed away at the end: one node
+//   per distinct prefix of at least "min_len" bits which has a list net
+//   strictly below it, i.e. per (net, length) with min_len <= length <
+//   the net's mask, counting each prefix once.  In sorted order, the
+//   lengths net i shares with all earlier nets are those up to its common
+//   prefix with net i-1 (inclusive), capped at the number net i-1 itself
+//   had with anything so far ("reach" below), so one linear walk counts
+//   them exactly.
+static unsigned nxt_count_nodes(const net_t* nets, const unsigned count, const unsigned min_len) {
+    unsigned long nodes = 0;
+    unsigned reach = 0;
+    v6w_t prev = { 0, 0 };
+    for(unsigned i = 0; i < count; i++) {
+        const net_t* n = &nets[i];
+        const v6w_t cur = v6w_load(n->ipv6);
+        unsigned shared = 0;
+        if(i) {
+            shared = v6w_common_bits(&cur, &prev) + 1U;
+            if(shared > reach)
+                shared = reach;
+        }
+        const unsigned from = shared > min_len ? shared : min_len;
+        if(n->mask > from)
+            nodes += n->mask - from;
+        reach = n->mask > shared ? n->mask : shared;
+        prev = cur;
+    }
+    assert(nodes < (1U << 24));
+    return nodes;
+}
 
-    const net_t* nl = *nlp;
-    unsigned cnode;
+// A slice of the list handed to one worker of a parallel build: the nets
+//   strictly below the prefix "net"/"mask", which it builds as that
+//   branch of the tree into its own region of the store.
+typedef struct {
+    v6w_t net;
+    unsigned mask;
+    unsigned dclist;      // default from the nets above the prefix
+    const net_t* first;
+    const net_t* end;
+    ntree_t region;       // a view of its part of the final store
+    unsigned cnode;       // the branch's value, region-relative if a node
+} nxt_job_t;
+
+// Walk state: the next list entry and, for the top of a parallel build,
+//   the jobs whose branches it skips over.
+typedef struct {
+    const net_t* nlnet;
+    const net_t* end;
+    v6w_t next;           // *nlnet's address, as words
+    const nxt_job_t* jobs;
+    unsigned njobs;
+    unsigned job_next;
+} nxt_walk_t;
+
+// Placeholder for a job's subtree in the top of a parallel build, until
+//   the regions are stitched together.  Never a valid node index (those
+//   are < 2^24), and never a dclist (no high bit).
+#define NXT_JOB_REF (1U << 30)
+
+static void nxt_seek(nxt_walk_t* w, const net_t* nlnet) {
+    w->nlnet = nlnet;
+    if(nlnet < w->end)
+        w->next = v6w_load(nlnet->ipv6);
+}
 
+// Evaluates the branch "sub"/"mask" with default "dclist".  If the branch
+//   needs a node, returns true with *cnode set to the default dclist for
+//   it.  Otherwise *cnode is set to the terminal for the branch.
+static bool nxt_branch(nxt_walk_t* w, const v6w_t* sub, const unsigned mask, const unsigned dclist, unsigned* cnode) {
     // If items remain in the list, and the next list item
-    //   is a subnet of (including exact match for) the current
-    //   ntree node...
-    if(nl < nl_end && net_subnet_of(nl, &tree_net)) {
+    //   is a subnet of (including exact match for) this
+    //   branch...
+    if(w->nlnet < w->end && w->nlnet->mask >= mask && v6w_prefix_eq(&w->next, sub, mask)) {
         // exact match, consume...
-        if(tree_net.mask == nl->mask) {
-            (*nlp)++; // consume *nlp and move to next
+        if(w->nlnet->mask == mask) {
+            const unsigned match_dclist = w->nlnet->dclist;
+            const v6w_t match = w->next;
+            nxt_seek(w, w->nlnet + 1);
             // need to pre-check for a deeper subnet next in the list.
-            // We use the consumed entry as the new default and keep recursing
-            //   if deeper subnets exist.  If they don't, we assign and end recursion...
-            const net_t* nl_next = *nlp;
-            if(nl_next < nl_end && net_subnet_of(nl_next, nl)) {
-                tree_net.dclist = nl->dclist;
-                cnode = nxt_rec(nlp, nl_end, nt, tree_net);
+            // We use the consumed entry as the new default and keep
+            //   descending if deeper subnets exist.  If they don't, we
+            //   assign and end this branch...
+            if(w->nlnet < w->end && w->nlnet->mask >= mask && v6w_prefix_eq(&w->next, &match, mask)) {
+                *cnode = match_dclist;
+                return true;
             }
-            else {
-                cnode = NN_SET_DCLIST(nl->dclist);
-            }
-        }
-        // Not an exact match, so just keep recursing towards such a match...
-        else {
-            cnode = nxt_rec(nlp, nl_end, nt, tree_net);
+            *cnode = NN_SET_DCLIST(match_dclist);
+            return false;
         }
+        // Not an exact match, so just keep descending towards such a match...
+        *cnode = dclist;
+        return true;
     }
-    // list item isn't a subnet of the current tree node, and due to our
+
+    // list item isn't a subnet of this branch, and due to our
     //   normalization that means there are no such list items remaining,
-    //   so terminate the recursion with the current default dclist.
-    else {
-        cnode = NN_SET_DCLIST(tree_net.dclist);
+    //   so terminate the branch with the current default dclist.
+    *cnode = NN_SET_DCLIST(dclist);
+    return false;
+}
+
+// One level of the nxt_node() walk: the node being filled in for the
+//   prefix "net"/"mask - 1", and which of its two branches is next.
+typedef struct {
+    v6w_t net;
+    unsigned mask; // of the node's zero/one branches
+    unsigned dclist; // default for anything not more specific
+    unsigned idx;
+    unsigned dir; // 0, 1, then 2 for done
+} nxt_frame_t;
+
+static void nxt_push(ntree_t* nt, nxt_frame_t* stack, unsigned* depth, const v6w_t* net, const unsigned mask, const unsigned dclist) {
+    assert(*depth < 128U);
+    assert(mask < 128U);
+    assert(nt->count < nt->alloc); // pre-sized exactly, never grows
+    nxt_frame_t* f = &stack[(*depth)++];
+    f->net = *net;
+    f->mask = mask + 1U; // now mask for zero/one stubs
+    f->dclist = dclist;
+    f->idx = ntree_add_node(nt);
+    f->dir = 0;
+}
+
+// Builds the node for the prefix "net"/"mask" and everything below it,
+//   depth-first, zero branch first, with an explicit stack of at most 128
+//   levels, and returns the value for the branch that leads to it.  A
+//   node whose two branches end up as the same dclist is deleted again
+//   (it's always the last one added) and replaced by that dclist in its
+//   parent, except for the root of the whole tree.
+static unsigned nxt_node(ntree_t* nt, nxt_walk_t* w, const v6w_t* net, const unsigned mask, const unsigned dclist, const bool is_root) {
+    nxt_frame_t stack[128];
+    unsigned depth = 0;
+    nxt_push(nt, stack, &depth, net, mask, dclist);
+
+    while(1) {
+        nxt_frame_t* f = &stack[depth - 1];
+
+        // both branches done, pop to the parent
+        if(f->dir == 2U) {
+            const nnode_t* node = &nt->store[f->idx];
+            unsigned cnode = f->idx;
+            // catch missed optimizations during final translation
+            if(node->zero == node->one && (depth > 1U || !is_root)) {
+                nt->count--; // delete the just-added node
+                cnode = node->zero;
+            }
+            if(!--depth)
+                return cnode;
+            f = &stack[depth - 1];
+            nt->store[f->idx].branch[f->dir++] = cnode;
+            continue;
+        }
+
+        const unsigned bmask = f->mask;
+        v6w_t sub = f->net;
+        if(f->dir)
+            v6w_setbit(&sub, bmask - 1U);
+
+        unsigned cnode;
+        const nxt_job_t* job = w->job_next < w->njobs ? &w->jobs[w->job_next] : NULL;
+        if(job && job->mask == bmask && v6w_prefix_eq(&job->net, &sub, bmask)) {
+            // a parallel job's branch, already built
+            cnode = NN_IS_DCLIST(job->cnode) ? job->cnode : (NXT_JOB_REF | w->job_next);
+            nxt_seek(w, job->end);
+            w->job_next++;
+        }
+        else if(nxt_branch(w, &sub, bmask, f->dclist, &cnode)) {
+            nxt_push(nt, stack, &depth, &sub, bmask, cnode);
+            continue;
+        }
+
+        nt->store[f->idx].branch[f->dir++] = cnode;
     }
+}
 
-    // store direct or recursed result.  Note we have to wait until
-    //   here to deref nt->store[nt_idx] because recursion could
-    //   re-allocate nt->store[] during nxt_rec()'s ntree_add_node() call.
-    if(direction)
-        nt->store[nt_idx].one = cnode;
-    else
-        nt->store[nt_idx].zero = cnode;
+static void nxt_job_run(nxt_job_t* job) {
+    nxt_walk_t w = { .end = job->end };
+    nxt_seek(&w, job->first);
+    if(nxt_branch(&w, &job->net, job->mask, job->dclist, &job->cnode))
+        job->cnode = nxt_node(&job->region, &w, &job->net, job->mask, job->cnode, false);
+    assert(w.nlnet == job->end);
+}
+
+typedef struct {
+    nxt_job_t* jobs;
+    unsigned njobs;
+    unsigned next; // atomic
+} nxt_pool_t;
+
+static void* nxt_worker(void* arg) {
+    nxt_pool_t* pool = arg;
+    unsigned j;
+    while((j = __atomic_fetch_add(&pool->next, 1U, __ATOMIC_RELAXED)) < pool->njobs)
+        nxt_job_run(&pool->jobs[j]);
+    return NULL;
 }
 
-static unsigned nxt_rec(const net_t** nl, const net_t* const nl_end, ntree_t* nt, net_t tree_net) {
-    assert(nl); assert(nl_end); assert(nt);
-    assert(tree_net.mask < 128);
-    tree_net.mask++; // now mask for zero/one stubs
+// Parallel builds only bother with lists at least this long, and cut
+//   them into jobs of at most (count / (threads * NXT_JOBS_PER_THREAD))
+//   nets, but no smaller than NXT_JOB_MIN, so that uneven jobs still
+//   balance out over the pool.
+#define NXT_PARALLEL_MIN 65536U
+#define NXT_JOBS_PER_THREAD 8U
+#define NXT_JOB_MIN 4096U
+
+// Cuts the list (less a leading ::/0, whose dclist is "dclist") into jobs
+//   in list order, by recursively halving prefixes on their next bit
+//   until the nets below each one are few enough.  A net exactly at a
+//   halved prefix stays with the top walk, and becomes the default for
+//   the jobs below it.  Returns the job count.
+static unsigned nxt_make_jobs(const net_t* first, const net_t* end, const unsigned dclist, const unsigned target, nxt_job_t** jobs_p) {
+    typedef struct {
+        const net_t* first;
+        const net_t* end;
+        v6w_t net;
+        unsigned mask;
+        unsigned dclist;
+    } pending_t;
+
+    unsigned alloc = 64;
+    unsigned njobs = 0;
+    nxt_job_t* jobs = malloc(alloc * sizeof(nxt_job_t));
+
+    // each halving replaces one entry with up to two, one level deeper
+    pending_t stack[129];
+    unsigned depth = 0;
+    if(first < end)
+        stack[depth++] = (pending_t) { first, end, { 0, 0 }, 0, dclist };
+
+    while(depth) {
+        pending_t p = stack[--depth];
+
+        if(p.mask && ((unsigned)(p.end - p.first) <= target || p.mask == 127U)) {
+            if(njobs == alloc) {
+                alloc <<= 1;
+                jobs = realloc(jobs, alloc * sizeof(nxt_job_t));
+            }
+            nxt_job_t* job = &jobs[njobs++];
+            memset(job, 0, sizeof(nxt_job_t));
+            job->net = p.net;
+            job->mask = p.mask;
+            job->dclist = p.dclist;
+            job->first = p.first;
+            job->end = p.end;
+            continue;
+        }
 
-    const unsigned nt_idx = ntree_add_node(nt);
-    nxt_rec_dir(nl, nl_end, nt, tree_net, nt_idx, false);
-    SETBIT_v6(tree_net.ipv6, tree_net.mask - 1);
-    nxt_rec_dir(nl, nl_end, nt, tree_net, nt_idx, true);
+        if(p.first->mask == p.mask) {
+            p.dclist = p.first->dclist;
+            p.first++;
+        }
 
-    unsigned rv = nt_idx;
+        // nets with bit "mask" set sort after all of those without
+        const net_t* lo = p.first;
+        const net_t* hi = p.end;
+        while(lo < hi) {
+            const net_t* mid = lo + (hi - lo) / 2;
+            if(mid->ipv6[p.mask >> 3] & (0x80U >> (p.mask & 7U)))
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
 
-    // catch missed optimizations during final translation
-    if(nt->store[nt_idx].zero == nt->store[nt_idx].one && nt_idx > 0) {
-        nt->count--; // delete the just-added node
-        rv = nt->store[nt_idx].zero;
+        pending_t one = { lo, p.end, p.net, p.mask + 1U, p.dclist };
+        v6w_setbit(&one.net, p.mask);
+        pending_t zero = { p.first, lo, p.net, p.mask + 1U, p.dclist };
+        if(one.first < one.end)
+            stack[depth++] = one;
+        if(zero.first < zero.end)
+            stack[depth++] = zero;
     }
 
-    return rv;
+    *jobs_p = jobs;
+    return njobs;
+}
+
+// The parallel form of the build in nlist_xlate_tree(): the jobs' branches
+//   are built concurrently into their own regions of the store, which is
+//   laid out as [top walk][job 0][job 1]..., each region sized exactly
+//   for its pre-collapse node count.  Then the top walk fills in the nodes
+//   above the jobs, and the regions are slid down over the space freed by
+//   collapsed nodes, rebasing their node indices as they go.  The result
+//   is the same set of nodes with the same branches as a sequential
+//   build, only numbered differently, which ntree_finish() erases.
+static void nxt_build_parallel(ntree_t* nt, const nlist_t* nl, const net_t* first, const unsigned root_dclist, const unsigned threads) {
+    const net_t* const end = &nl->nets[nl->count];
+    unsigned target = nl->count / (threads * NXT_JOBS_PER_THREAD);
+    if(target < NXT_JOB_MIN)
+        target = NXT_JOB_MIN;
+
+    nxt_job_t* jobs;
+    const unsigned njobs = nxt_make_jobs(first, end, root_dclist, target, &jobs);
+
+    // regions, after the top walk's
+    unsigned job_nodes = 0;
+    for(unsigned j = 0; j < njobs; j++) {
+        jobs[j].region.alloc = nxt_count_nodes(jobs[j].first, jobs[j].end - jobs[j].first, jobs[j].mask);
+        job_nodes += jobs[j].region.alloc;
+    }
+    assert(job_nodes <= nt->alloc);
+    unsigned offset = nt->alloc - job_nodes;
+    for(unsigned j = 0; j < njobs; j++) {
+        jobs[j].region.store = &nt->store[offset];
+        offset += jobs[j].region.alloc;
+    }
+
+    // the calling thread works too
+    nxt_pool_t pool = { jobs, njobs, 0 };
+    const unsigned nthreads = threads < njobs ? threads : njobs;
+    const unsigned nworkers = nthreads ? nthreads - 1U : 0;
+    pthread_t workers[nworkers ? nworkers : 1U];
+    unsigned started = 0;
+    while(started < nworkers && !pthread_create(&workers[started], NULL, nxt_worker, &pool))
+        started++;
+    nxt_worker(&pool);
+    for(unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    // the top, with placeholders for the jobs' subtrees
+    const v6w_t root = { 0, 0 };
+    ntree_t top = { .store = nt->store, .alloc = nt->alloc - job_nodes };
+    nxt_walk_t w = { .end = end, .jobs = jobs, .njobs = njobs };
+    nxt_seek(&w, first);
+    nxt_node(&top, &w, &root, 0, root_dclist, true);
+    assert(w.nlnet == end);
+    assert(w.job_next == njobs);
+    nt->count = top.count;
+
+    // stitch: slide each region down to the end of the last, and rebase
+    unsigned* base = malloc(njobs * sizeof(unsigned));
+    unsigned count = nt->count;
+    for(unsigned j = 0; j < njobs; j++) {
+        const ntree_t* r = &jobs[j].region;
+        base[j] = count;
+        for(unsigned i = 0; i < r->count; i++) {
+            for(unsigned b = 0; b < 2U; b++) {
+                const uint32_t child = r->store[i].branch[b];
+                nt->store[count + i].branch[b] = NN_IS_DCLIST(child) ? child : child + count;
+            }
+        }
+        count += r->count;
+    }
+    for(unsigned i = 0; i < nt->count; i++) {
+        for(unsigned b = 0; b < 2U; b++) {
+            const uint32_t child = nt->store[i].branch[b];
+            if(!NN_IS_DCLIST(child) && (child & NXT_JOB_REF))
+                nt->store[i].branch[b] = base[child & ~NXT_JOB_REF];
+        }
+    }
+    nt->count = count;
+
+    free(base);
+    free(jobs);
 }
 
-ntree_t* nlist_xlate_tree(const nlist_t* nl) {
+ntree_t* nlist_xlate_tree(const nlist_t* nl, const unsigned threads) {
     assert(nl);
-    assert(nl->normalized);
+    assert(nl->finished);
 
-    ntree_t* nt = ntree_new();
     const net_t* nlnet = &nl->nets[0];
-    const net_t* const nlnet_end = &nl->nets[nl->count];
-    net_t tree_net = {
-        .ipv6 = { 0 },
-        .mask = 0,
-        .dclist = 0
-    };
+    unsigned root_dclist = 0;
 
     // Special-case: if a list entry for ::/0 exists, it will
     //   be first in the list, and it needs to be skipped
     //   over (with its dclist as the new default) before
-    //   recursing (because ::/0 is the first node of the
+    //   building (because ::/0 is the first node of the
     //   tree itself).
     if(nl->count && !nl->nets[0].mask) {
-        tree_net.dclist = nl->nets[0].dclist;
+        root_dclist = nl->nets[0].dclist;
         nlnet++;
     }
 
-    // recursively build the tree from the list
-    nxt_rec(&nlnet, nlnet_end, nt, tree_net);
+    // The store is allocated once, at the exact pre-collapse node count
+    //   (and at least the root), and ntree_finish() re-lays it out anyway.
+    const unsigned nodes = nxt_count_nodes(nl->nets, nl->count, 0);
+    ntree_t* nt = ntree_new(nodes ? nodes : 1U);
 
-    // assert that the whole list was consumed
-    assert(nlnet == nlnet_end);
+    if(threads > 1U && nl->count >= NXT_PARALLEL_MIN) {
+        nxt_build_parallel(nt, nl, nlnet, root_dclist, threads);
+    }
+    else {
+        const v6w_t root = { 0, 0 };
+        nxt_walk_t w = { .end = &nl->nets[nl->count] };
+        nxt_seek(&w, nlnet);
+        nxt_node(nt, &w, &root, 0, root_dclist, true);
+        // assert that the whole list was consumed
+        assert(w.nlnet == w.end);
+    }
 
     // finalize the tree
     ntree_finish(nt);
 
     return nt;
 }
+
+// Bit "bit" of an address, 0->127 (MSB -> LSB)
+static unsigned v6w_bit(const v6w_t* w, const unsigned bit) {
+    assert(bit < 128U);
+    return bit < 64U
+        ? (unsigned)(w->hi >> (63U - bit)) & 1U
+        : (unsigned)(w->lo >> (127U - bit)) & 1U;
+}
+
+// The first of the sorted nets which doesn't sort before "ipv6"/"mask"
+static const net_t* nets_lower_bound(const net_t* first, const net_t* end, const uint8_t* ipv6, const unsigned mask) {
+    net_t key;
+    memcpy(key.ipv6, ipv6, 16U);
+    key.mask = mask;
+    while(first < end) {
+        const net_t* mid = first + (end - first) / 2;
+        if(net_sorter(mid, &key) < 0)
+            first = mid + 1;
+        else
+            end = mid;
+    }
+    return first;
+}
+
+// The entry for exactly "ipv6"/"mask" in a finished list, or NULL
+static const net_t* nlist_find(const nlist_t* nl, const uint8_t* ipv6, const unsigned mask) {
+    const net_t* end = &nl->nets[nl->count];
+    const net_t* n = nets_lower_bound(nl->nets, end, ipv6, mask);
+    return n < end && n->mask == mask && !memcmp(n->ipv6, ipv6, 16U) ? n : NULL;
+}
+
+unsigned nlist_overlay_get(const nlist_t* base, const nlist_t* ovl, const uint8_t* ipv6, const unsigned mask) {
+    assert(base); assert(base->finished);
+    assert(!ovl || ovl->finished);
+    assert(ipv6);
+
+    const net_t* n = ovl ? nlist_find(ovl, ipv6, mask) : NULL;
+    if(!n)
+        n = nlist_find(base, ipv6, mask);
+    return n ? n->dclist : NLIST_REMOVED;
+}
+
+nlist_t* nlist_overlay_merge(const nlist_t* ovl, const nlist_t* chg) {
+    assert(!ovl || ovl->finished);
+    assert(chg); assert(chg->finished);
+
+    const unsigned ocount = ovl ? ovl->count : 0;
+    nlist_t* nl = malloc(sizeof(nlist_t));
+    nl->alloc = ocount + chg->count;
+    if(!nl->alloc)
+        nl->alloc = 1U;
+    nl->nets = malloc(nl->alloc * sizeof(net_t));
+    nl->count = 0;
+    nl->finished = true;
+
+    unsigned i = 0;
+    unsigned j = 0;
+    while(i < ocount || j < chg->count) {
+        int cmp;
+        if(i == ocount)
+            cmp = 1;
+        else if(j == chg->count)
+            cmp = -1;
+        else
+            cmp = net_sorter(&ovl->nets[i], &chg->nets[j]);
+        if(cmp < 0) {
+            nl->nets[nl->count++] = ovl->nets[i++];
+        }
+        else {
+            if(!cmp)
+                i++; // replaced
+            nl->nets[nl->count++] = chg->nets[j++];
+        }
+    }
+
+    return nl;
+}
+
+// The nets in effect at or below the prefix "ipv6"/"mask", in order, into
+//   *buf_p (grown as needed).  Returns the count.
+static unsigned nxt_effective(const nlist_t* base, const nlist_t* ovl, const uint8_t* ipv6, const unsigned mask, net_t** buf_p, unsigned* alloc_p) {
+    // nets sorting from ipv6/mask to the end of the prefix, which excludes
+    //   its supernets at the same address
+    uint8_t last[16];
+    memcpy(last, ipv6, 16U);
+    for(unsigned bit = mask; bit < 128U; bit++)
+        SETBIT_v6(last, bit);
+
+    const net_t* bend = &base->nets[base->count];
+    const net_t* b = nets_lower_bound(base->nets, bend, ipv6, mask);
+    bend = nets_lower_bound(b, bend, last, 129U);
+    const net_t* oend = &ovl->nets[ovl->count];
+    const net_t* o = nets_lower_bound(ovl->nets, oend, ipv6, mask);
+    oend = nets_lower_bound(o, oend, last, 129U);
+
+    const unsigned most = (unsigned)(bend - b) + (unsigned)(oend - o);
+    if(most > *alloc_p) {
+        *alloc_p = most;
+        *buf_p = realloc(*buf_p, most * sizeof(net_t));
+    }
+
+    net_t* buf = *buf_p;
+    unsigned count = 0;
+    while(b < bend || o < oend) {
+        int cmp;
+        if(b == bend)
+            cmp = 1;
+        else if(o == oend)
+            cmp = -1;
+        else
+            cmp = net_sorter(b, o);
+        if(cmp < 0) {
+            buf[count++] = *b++;
+        }
+        else {
+            if(!cmp)
+                b++; // replaced or hidden
+            if(o->dclist != NLIST_REMOVED)
+                buf[count++] = *o;
+            o++;
+        }
+    }
+
+    return count;
+}
+
+// The dclist in effect for the prefix "ipv6"/"mask" from above it: that of
+//   the longest net in effect which strictly covers it, if any
+static unsigned nxt_covering(const nlist_t* base, const nlist_t* ovl, const uint8_t* ipv6, const unsigned mask) {
+    uint8_t super[16];
+    for(unsigned m = mask; m--; ) {
+        memcpy(super, ipv6, 16U);
+        clear_mask_bits(super, m);
+        const unsigned dclist = nlist_overlay_get(base, ovl, super, m);
+        if(dclist != NLIST_REMOVED)
+            return dclist;
+    }
+    return 0;
+}
+
+// Rebuilds the branch for the prefix "net"/"mask" from "nets" (those in
+//   effect at or below it, "count" of them), whose default from above is
+//   "above", and then the path from the root down to it.  Path nodes are
+//   copied rather than changed, as older versions of the tree may still
+//   be in use, except for those at "own" and beyond, which this update
+//   added itself.  A copy whose branches come out as the same dclist is
+//   collapsed, and a path which had ended in a dclist above the prefix is
+//   extended with nodes that fill the rest of their branches with it.
+//   Returns the new root.
+static unsigned nxt_update(ntree_t* nt, const unsigned root, const unsigned own, const net_t* nets, const unsigned count, const v6w_t* net, const unsigned mask, const unsigned above) {
+    nxt_walk_t w = { .end = &nets[count] };
+    nxt_seek(&w, nets);
+
+    if(!mask) {
+        // the whole tree, as in nlist_xlate_tree()
+        unsigned root_dclist = 0;
+        if(count && !nets[0].mask) {
+            root_dclist = nets[0].dclist;
+            nxt_seek(&w, &nets[1]);
+        }
+        const unsigned new_root = nxt_node(nt, &w, net, 0, root_dclist, true);
+        assert(w.nlnet == w.end);
+        return new_root;
+    }
+
+    unsigned val;
+    if(nxt_branch(&w, net, mask, above, &val))
+        val = nxt_node(nt, &w, net, mask, val, false);
+    assert(w.nlnet == w.end);
+
+    uint32_t path[128];
+    uint32_t ref = root;
+    for(unsigned d = 0; d < mask; d++) {
+        path[d] = ref;
+        if(!NN_IS_DCLIST(ref))
+            ref = nt->store[ref].branch[v6w_bit(net, d)];
+    }
+
+    for(unsigned d = mask; d--; ) {
+        const unsigned bit = v6w_bit(net, d);
+        nnode_t node;
+        if(NN_IS_DCLIST(path[d]))
+            node.zero = node.one = path[d];
+        else
+            node = nt->store[path[d]];
+        if(node.branch[bit] == val)
+            return root; // no change from here up
+        node.branch[bit] = val;
+        if(d && node.zero == node.one) {
+            val = node.zero;
+            continue;
+        }
+        if(!NN_IS_DCLIST(path[d]) && path[d] >= own) {
+            nt->store[path[d]] = node;
+            return root; // same node, so no change further up
+        }
+        assert(nt->count < nt->alloc);
+        val = ntree_add_node(nt);
+        nt->store[val] = node;
+    }
+
+    return val;
+}
+
+bool nlist_xlate_update(const nlist_t* base, const nlist_t* ovl, const nlist_t* chg, ntree_t* tree, unsigned* need_p) {
+    assert(base); assert(base->finished);
+    assert(ovl); assert(ovl->finished);
+    assert(chg); assert(chg->finished);
+    assert(tree); assert(tree->alloc);
+    assert(need_p);
+
+    const unsigned own = tree->count;
+    unsigned root = tree->root;
+    net_t* buf = NULL;
+    unsigned buf_alloc = 0;
+    const net_t* done = NULL; // the last prefix rebuilt
+
+    for(unsigned i = 0; i < chg->count; i++) {
+        const net_t* c = &chg->nets[i];
+        const v6w_t net = v6w_load(c->ipv6);
+
+        // covered by an earlier change in this same batch (which sorts
+        //   before everything below it), so already rebuilt
+        if(done && c->mask >= done->mask) {
+            const v6w_t dnet = v6w_load(done->ipv6);
+            if(v6w_prefix_eq(&net, &dnet, done->mask))
+                continue;
+        }
+        done = c;
+
+        const unsigned count = nxt_effective(base, ovl, c->ipv6, c->mask, &buf, &buf_alloc);
+        const unsigned nodes = nxt_count_nodes(buf, count, c->mask) + c->mask + 1U;
+        if(tree->alloc - tree->count < nodes) {
+            *need_p = tree->count - own + nodes;
+            tree->count = own;
+            free(buf);
+            return true;
+        }
+
+        const unsigned above = c->mask ? nxt_covering(base, ovl, c->ipv6, c->mask) : 0;
+        root = nxt_update(tree, root, own, buf, count, &net, c->mask, above);
+    }
+
+    free(buf);
+    ntree_set_root(tree, root);
+    return false;
+}
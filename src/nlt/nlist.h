@@ -40,6 +40,45 @@ bool nlist_append(nlist_t* nl, const uint8_t* ipv6, const unsigned mask, const u
 void nlist_finish(nlist_t* nl);
 
 // must pass through _finish() before xlate!
-ntree_t* nlist_xlate_tree(const nlist_t* nl_a);
+// With "threads" > 1, large lists are cut into slices by prefix which are
+//   built into the tree on up to that many threads (counting the caller).
+//   The finished tree is identical either way.
+ntree_t* nlist_xlate_tree(const nlist_t* nl_a, const unsigned threads);
+
+// An alternative to nlist_finish() for lists that are kept around to
+//   update the tree later: it only sorts the list and drops exact
+//   duplicates (the first appended wins, as in nlist_finish(), unless
+//   "last_wins"), without merging anything, so that the list still holds
+//   the networks as they were given.  nlist_xlate_tree() builds the same
+//   tree from it as from the merged form.
+void nlist_finish_unmerged(nlist_t* nl, const bool last_wins);
+
+unsigned nlist_count(const nlist_t* nl);
+
+// Incremental updates, for a tree built from an unmerged list "base".
+//   The networks in effect are those of "base" as changed by an overlay
+//   list "ovl", whose entries replace the base entries for the same
+//   networks, or hide them if their dclist is NLIST_REMOVED.  Both are
+//   unmerged lists, and neither is ever modified.
+#define NLIST_REMOVED 0xFFFFFFFEU
+
+// The dclist in effect for exactly "ipv6"/"mask", or NLIST_REMOVED if
+//   there's none.  "ovl" may be NULL.
+unsigned nlist_overlay_get(const nlist_t* base, const nlist_t* ovl, const uint8_t* ipv6, const unsigned mask);
+
+// A new overlay list, with the entries of the unmerged list "chg" added
+//   to (or replacing those in) "ovl", which may be NULL.
+nlist_t* nlist_overlay_merge(const nlist_t* ovl, const nlist_t* chg);
+
+// Updates "tree", built from base as changed by an older overlay, to
+//   "ovl", which is that overlay with "chg" merged in.  Only the branches
+//   at and below the networks in "chg" are rebuilt, and new copies of
+//   the paths down to them are appended to the store, so that the older
+//   tree (the same store, with the old root and count) stays intact.
+//   "tree" must be a finished tree with its alloc set to the room in the
+//   store, and this updates its count and root (and ipv4 hint).  If the
+//   room runs out, the tree is left as it was and true is returned, with
+//   *need_p set to a node count to make room for before trying again.
+bool nlist_xlate_update(const nlist_t* base, const nlist_t* ovl, const nlist_t* chg, ntree_t* tree, unsigned* need_p);
 
 #endif // NLIST_H
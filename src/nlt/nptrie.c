@@ -0,0 +1,226 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "nptrie.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NP_STRIDE 6U
+
+// Initial allocation counts,
+//   must be power of two due to alloc code,
+static const unsigned NP_NODES_INIT = 64;
+static const unsigned NP_LEAVES_INIT = 256;
+
+// adds "count" contiguous nodes, returns the index of the first
+static unsigned nptrie_add_nodes(nptrie_t* pt, const unsigned count) {
+    assert(pt); assert(count);
+    while(pt->node_count + count > pt->node_alloc) {
+        pt->node_alloc <<= 1;
+        pt->nodes = realloc(pt->nodes, pt->node_alloc * sizeof(nptrie_node_t));
+    }
+    const unsigned rv = pt->node_count;
+    pt->node_count += count;
+    assert(pt->node_count < (1U << 31));
+    return rv;
+}
+
+static void nptrie_add_leaf(nptrie_t* pt, const uint32_t dclist) {
+    assert(pt);
+    if(pt->leaf_count == pt->leaf_alloc) {
+        pt->leaf_alloc <<= 1;
+        pt->leaves = realloc(pt->leaves, pt->leaf_alloc * sizeof(uint32_t));
+    }
+    pt->leaves[pt->leaf_count++] = dclist;
+}
+
+// Fill in node "ni" from the ntree node "ref", which sits "depth" bits
+//   into an address of "bits" total length.  Note nodes are referenced by
+//   index rather than pointer, because the adds can move the storage.
+static void nptrie_build(nptrie_t* pt, const ntree_t* tree, const unsigned ni, const uint32_t ref, const unsigned depth, const unsigned bits) {
+    assert(pt); assert(tree);
+    assert(!NN_IS_DCLIST(ref));
+    assert(depth < bits);
+
+    const unsigned stride = (bits - depth) < NP_STRIDE ? (bits - depth) : NP_STRIDE;
+    const unsigned nslots = 1U << stride;
+
+    uint32_t slot_ref[1U << NP_STRIDE];
+    uint64_t vector = 0;
+    uint64_t leafvec = 0;
+    unsigned nchild = 0;
+    uint32_t last_leaf = 0;
+    const unsigned base0 = pt->leaf_count;
+
+    // walk the binary tree "stride" bits down for every slot
+    for(unsigned i = 0; i < nslots; i++) {
+        uint32_t r = ref;
+        for(unsigned k = 0; k < stride && !NN_IS_DCLIST(r); k++) {
+            assert(r < tree->count);
+            const nnode_t* node = &tree->store[r];
+            r = ((i >> (stride - 1 - k)) & 1) ? node->one : node->zero;
+        }
+        slot_ref[i] = r;
+        if(NN_IS_DCLIST(r)) {
+            // last_leaf can't be zero once set, as it has the high bit
+            if(r != last_leaf) {
+                leafvec |= (1ULL << i);
+                nptrie_add_leaf(pt, NN_GET_DCLIST(r));
+                last_leaf = r;
+            }
+        }
+        else {
+            vector |= (1ULL << i);
+            nchild++;
+        }
+    }
+
+    const unsigned base1 = nchild ? nptrie_add_nodes(pt, nchild) : 0;
+    nptrie_node_t* node = &pt->nodes[ni];
+    node->vector = vector;
+    node->leafvec = leafvec;
+    node->base0 = base0;
+    node->base1 = base1;
+
+    unsigned child = base1;
+    for(unsigned i = 0; i < nslots; i++)
+        if(vector & (1ULL << i))
+            nptrie_build(pt, tree, child++, slot_ref[i], depth + stride, bits);
+}
+
+nptrie_t* nptrie_new(const ntree_t* tree) {
+    assert(tree);
+    assert(!tree->alloc); // ntree_finish() was called
+    assert(tree->count);
+
+    nptrie_t* pt = malloc(sizeof(nptrie_t));
+    pt->node_count = 0;
+    pt->node_alloc = NP_NODES_INIT;
+    pt->nodes = malloc(pt->node_alloc * sizeof(nptrie_node_t));
+    pt->leaf_count = 0;
+    pt->leaf_alloc = NP_LEAVES_INIT;
+    pt->leaves = malloc(pt->leaf_alloc * sizeof(uint32_t));
+
+    // the ntree root is always a real node
+    pt->v6root = nptrie_add_nodes(pt, 1);
+    nptrie_build(pt, tree, pt->v6root, tree->root, 0, 128);
+
+    if(NN_IS_DCLIST(tree->ipv4)) {
+        pt->v4root = tree->ipv4;
+    }
+    else {
+        pt->v4root = nptrie_add_nodes(pt, 1);
+        nptrie_build(pt, tree, pt->v4root, tree->ipv4, 0, 32);
+    }
+
+    // trim excess storage
+    pt->node_alloc = 0;
+    pt->leaf_alloc = 0;
+    pt->nodes = realloc(pt->nodes, pt->node_count * sizeof(nptrie_node_t));
+    pt->leaves = realloc(pt->leaves, pt->leaf_count * sizeof(uint32_t));
+
+    return pt;
+}
+
+void nptrie_destroy(nptrie_t* pt) {
+    assert(pt);
+    free(pt->nodes);
+    free(pt->leaves);
+    free(pt);
+}
+
+size_t nptrie_size(const nptrie_t* pt) {
+    assert(pt);
+    return sizeof(nptrie_t)
+        + (size_t)pt->node_count * sizeof(nptrie_node_t)
+        + (size_t)pt->leaf_count * sizeof(uint32_t);
+}
+
+// The next "stride" bits of the 128-bit address hi:lo at bit offset "off"
+static inline unsigned nptrie_slot(const uint64_t hi, const uint64_t lo, const unsigned off, const unsigned stride) {
+    assert(off < 128); assert(stride && stride <= NP_STRIDE);
+    uint64_t window;
+    if(off >= 64)
+        window = lo << (off - 64);
+    else if(off)
+        window = (hi << off) | (lo >> (64 - off));
+    else
+        window = hi;
+    return (unsigned)(window >> (64 - stride));
+}
+
+static unsigned nptrie_walk(const nptrie_t* pt, uint32_t ni, const uint64_t hi, const uint64_t lo, const unsigned bits) {
+    assert(pt);
+    assert(!pt->node_alloc); // construction finished
+
+    unsigned off = 0;
+    while(1) {
+        assert(ni < pt->node_count);
+        assert(off < bits);
+        const nptrie_node_t* node = &pt->nodes[ni];
+        const unsigned stride = (bits - off) < NP_STRIDE ? (bits - off) : NP_STRIDE;
+        const uint64_t bit = 1ULL << nptrie_slot(hi, lo, off, stride);
+        const uint64_t upto = bit | (bit - 1);
+        if(!(node->vector & bit)) {
+            const unsigned leaf = node->base0 + (unsigned)__builtin_popcountll(node->leafvec & upto) - 1;
+            assert(leaf < pt->leaf_count);
+            assert(pt->leaves[leaf] != NN_GET_DCLIST(NN_UNDEF));
+            return pt->leaves[leaf];
+        }
+        ni = node->base1 + (unsigned)__builtin_popcountll(node->vector & upto) - 1;
+        off += stride;
+    }
+}
+
+unsigned nptrie_lookup_v4(const nptrie_t* pt, const uint32_t ipv4) {
+    assert(pt);
+
+    unsigned rv;
+    if(NN_IS_DCLIST(pt->v4root))
+        rv = NN_GET_DCLIST(pt->v4root);
+    else
+        rv = nptrie_walk(pt, pt->v4root, (uint64_t)ipv4 << 32, 0, 32);
+    return rv;
+}
+
+unsigned nptrie_lookup_v6(const nptrie_t* pt, const uint8_t* ipv6) {
+    assert(pt); assert(ipv6);
+
+    unsigned rv;
+
+    uint32_t ipv4;
+    if(v6_v4fixup(ipv6, &ipv4)) {
+        rv = nptrie_lookup_v4(pt, ipv4);
+    }
+    else {
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+        for(unsigned i = 0; i < 8; i++) {
+            hi = (hi << 8) | ipv6[i];
+            lo = (lo << 8) | ipv6[i + 8];
+        }
+        rv = nptrie_walk(pt, pt->v6root, hi, lo, 128);
+    }
+
+    return rv;
+}
@@ -0,0 +1,73 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NPTRIE_H
+#define NPTRIE_H
+
+#include "config.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include "ntree.h"
+
+/*
+ * A poptrie-style multibit trie (Asai & Ohara, SIGCOMM 2015) with a 6-bit
+ * stride, built from a finished ntree_t.  Each node covers 64 slots for
+ * the next 6 address bits.  "vector" has a bit set for each slot that
+ * continues into a child node, and the children of a node are stored
+ * contiguously from "base1", so a child is found with a popcount of the
+ * vector below the slot.  The remaining (leaf) slots are run-length
+ * compressed the same way: "leafvec" marks the slots where a new leaf
+ * value starts, and leaves are stored contiguously from "base0".
+ *
+ * Since it's built from the ntree itself, lookups return exactly what
+ * ntree_lookup() would.  IPv4 gets its own root for the ::/96 subtree so
+ * that v4 lookups don't have to step through 16 levels of zeros.
+ */
+
+typedef struct {
+    uint64_t vector;
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+} nptrie_node_t;
+
+typedef struct {
+    nptrie_node_t* nodes;
+    uint32_t* leaves;
+    unsigned node_count;
+    unsigned node_alloc;
+    unsigned leaf_count;
+    unsigned leaf_alloc;
+    uint32_t v6root; // node index, or dclist w/ high-bit set
+    uint32_t v4root; // node index, or dclist w/ high-bit set
+} nptrie_t;
+
+// tree must be finished already
+nptrie_t* nptrie_new(const ntree_t* tree);
+
+void nptrie_destroy(nptrie_t* pt);
+
+// memory used by the trie, in bytes
+size_t nptrie_size(const nptrie_t* pt);
+
+// Same arguments and results as ntree_lookup_v4() and ntree_lookup_v6()
+unsigned nptrie_lookup_v4(const nptrie_t* pt, const uint32_t ipv4);
+unsigned nptrie_lookup_v6(const nptrie_t* pt, const uint8_t* ipv6);
+
+#endif // NPTRIE_H
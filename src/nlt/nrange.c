@@ -0,0 +1,285 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "nrange.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// unsigned compares via the signed SSE2 instructions
+#define NR_FLIP 0x80000000U
+
+// Initial range allocation count during flattening,
+//   must be power of two due to alloc code,
+static const unsigned NR_SIZE_INIT = 256;
+
+/**********************
+ * Flattening helpers *
+ **********************/
+
+typedef struct {
+    uint32_t* starts4;
+    nrange_key6_t* starts6;
+    uint32_t* vals;
+    unsigned count;
+    unsigned alloc;
+} nr_flat_t;
+
+static void nr_flat_init(nr_flat_t* f, const bool v6) {
+    f->count = 0;
+    f->alloc = NR_SIZE_INIT;
+    f->starts4 = v6 ? NULL : malloc(f->alloc * sizeof(uint32_t));
+    f->starts6 = v6 ? malloc(f->alloc * sizeof(nrange_key6_t)) : NULL;
+    f->vals = malloc(f->alloc * sizeof(uint32_t));
+}
+
+static void nr_flat_free(nr_flat_t* f) {
+    free(f->starts4);
+    free(f->starts6);
+    free(f->vals);
+}
+
+// returns true if a new range is needed, growing storage as necc
+static bool nr_flat_want(nr_flat_t* f, const uint32_t ref) {
+    if(f->count && f->vals[f->count - 1] == ref)
+        return false; // same value continues the previous range
+    if(f->count == f->alloc) {
+        f->alloc <<= 1;
+        if(f->starts4)
+            f->starts4 = realloc(f->starts4, f->alloc * sizeof(uint32_t));
+        else
+            f->starts6 = realloc(f->starts6, f->alloc * sizeof(nrange_key6_t));
+        f->vals = realloc(f->vals, f->alloc * sizeof(uint32_t));
+    }
+    return true;
+}
+
+static void nr_flatten4(const ntree_t* tree, const uint32_t ref, const unsigned depth, const uint32_t start, nr_flat_t* f) {
+    assert(depth <= 32);
+    if(NN_IS_DCLIST(ref)) {
+        if(nr_flat_want(f, ref)) {
+            f->starts4[f->count] = start;
+            f->vals[f->count++] = ref;
+        }
+    }
+    else {
+        assert(depth < 32);
+        assert(ref < tree->count);
+        const nnode_t* node = &tree->store[ref];
+        nr_flatten4(tree, node->zero, depth + 1, start, f);
+        nr_flatten4(tree, node->one, depth + 1, start | (1U << (31 - depth)), f);
+    }
+}
+
+static void nr_flatten6(const ntree_t* tree, const uint32_t ref, const unsigned depth, const nrange_key6_t start, nr_flat_t* f) {
+    assert(depth <= 128);
+    if(NN_IS_DCLIST(ref)) {
+        if(nr_flat_want(f, ref)) {
+            f->starts6[f->count] = start;
+            f->vals[f->count++] = ref;
+        }
+    }
+    else {
+        assert(depth < 128);
+        assert(ref < tree->count);
+        const nnode_t* node = &tree->store[ref];
+        nrange_key6_t one = start;
+        if(depth < 64)
+            one.hi |= (1ULL << (63 - depth));
+        else
+            one.lo |= (1ULL << (127 - depth));
+        nr_flatten6(tree, node->zero, depth + 1, start, f);
+        nr_flatten6(tree, node->one, depth + 1, one, f);
+    }
+}
+
+/*****************************
+ * IPv4 S-tree (16-ary)      *
+ *****************************/
+
+static inline unsigned nr_child(const unsigned k, const unsigned i) {
+    return k * (NR_B + 1) + i + 1;
+}
+
+// In-order fill of the static B-tree from the sorted boundaries,
+//   padding the tail of the last blocks with all-ones keys
+static void nr_stree_fill(nrange_t* nr, const nr_flat_t* f, unsigned* t, const unsigned k) {
+    if(k < nr->nblocks4) {
+        for(unsigned i = 0; i < NR_B; i++) {
+            nr_stree_fill(nr, f, t, nr_child(k, i));
+            const unsigned slot = k * NR_B + i;
+            // boundary j (starting from 1) is starts4[j], below it is vals[j - 1]
+            if(*t + 1 < f->count) {
+                nr->keys4[slot] = f->starts4[*t + 1] ^ NR_FLIP;
+                nr->vals4[slot] = NN_GET_DCLIST(f->vals[*t]);
+                (*t)++;
+            }
+            else {
+                nr->keys4[slot] = UINT32_MAX ^ NR_FLIP;
+                nr->vals4[slot] = nr->last4;
+            }
+        }
+        nr_stree_fill(nr, f, t, nr_child(k, NR_B));
+    }
+}
+
+/*****************************
+ * IPv6 Eytzinger            *
+ *****************************/
+
+static void nr_eytz_fill(nrange_t* nr, const nr_flat_t* f, unsigned* t, const unsigned k) {
+    if(k <= nr->n6) {
+        nr_eytz_fill(nr, f, t, 2 * k);
+        nr->keys6[k] = f->starts6[*t + 1];
+        nr->vals6[k] = NN_GET_DCLIST(f->vals[*t]);
+        (*t)++;
+        nr_eytz_fill(nr, f, t, 2 * k + 1);
+    }
+}
+
+nrange_t* nrange_new(const ntree_t* tree) {
+    assert(tree);
+    assert(!tree->alloc); // ntree_finish() was called
+
+    nrange_t* nr = malloc(sizeof(nrange_t));
+    nr_flat_t f;
+    unsigned t;
+
+    // IPv4, from the cached v4 root
+    nr_flat_init(&f, false);
+    nr_flatten4(tree, tree->ipv4, 0, 0, &f);
+    assert(f.count && !f.starts4[0]);
+    nr->last4 = NN_GET_DCLIST(f.vals[f.count - 1]);
+    nr->nblocks4 = (f.count - 1 + NR_B - 1) / NR_B;
+    const size_t size4 = nr->nblocks4 ? nr->nblocks4 * NR_B * sizeof(uint32_t) : 64;
+    if(posix_memalign((void**)&nr->keys4, 64, size4))
+        abort();
+    nr->vals4 = malloc(size4);
+    t = 0;
+    nr_stree_fill(nr, &f, &t, 0);
+    assert(t + 1 == f.count);
+    nr_flat_free(&f);
+
+    // IPv6, the whole tree
+    const nrange_key6_t zero6 = { 0, 0 };
+    nr_flat_init(&f, true);
+    nr_flatten6(tree, tree->root, 0, zero6, &f);
+    assert(f.count && !f.starts6[0].hi && !f.starts6[0].lo);
+    nr->last6 = NN_GET_DCLIST(f.vals[f.count - 1]);
+    nr->n6 = f.count - 1;
+    if(posix_memalign((void**)&nr->keys6, 64, (nr->n6 + 1) * sizeof(nrange_key6_t)))
+        abort();
+    nr->vals6 = malloc((nr->n6 + 1) * sizeof(uint32_t));
+    memset(&nr->keys6[0], 0, sizeof(nrange_key6_t)); // unused slot zero
+    nr->vals6[0] = 0;
+    t = 0;
+    nr_eytz_fill(nr, &f, &t, 1);
+    assert(t == nr->n6);
+    nr_flat_free(&f);
+
+    return nr;
+}
+
+void nrange_destroy(nrange_t* nr) {
+    assert(nr);
+    free(nr->keys4);
+    free(nr->vals4);
+    free(nr->keys6);
+    free(nr->vals6);
+    free(nr);
+}
+
+size_t nrange_size(const nrange_t* nr) {
+    assert(nr);
+    return sizeof(nrange_t)
+        + (size_t)nr->nblocks4 * NR_B * 2 * sizeof(uint32_t)
+        + ((size_t)nr->n6 + 1) * (sizeof(nrange_key6_t) + sizeof(uint32_t));
+}
+
+// how many keys of the sorted block are <= x (both sign-flipped)
+static inline unsigned nr_block_rank(const uint32_t* block, const uint32_t x) {
+#ifdef __SSE2__
+    const __m128i xv = _mm_set1_epi32((int)x);
+    unsigned gt = 0;
+    for(unsigned q = 0; q < NR_B / 4; q++) {
+        const __m128i kv = _mm_load_si128((const __m128i*)&block[q * 4]);
+        const __m128i cmp = _mm_cmpgt_epi32(kv, xv);
+        gt |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(cmp)) << (q * 4);
+    }
+    return (unsigned)__builtin_ctz(gt | (1U << NR_B));
+#else
+    unsigned i = 0;
+    while(i < NR_B && (int32_t)block[i] <= (int32_t)x)
+        i++;
+    return i;
+#endif
+}
+
+unsigned nrange_lookup_v4(const nrange_t* nr, const uint32_t ipv4) {
+    assert(nr);
+
+    const uint32_t x = ipv4 ^ NR_FLIP;
+    uint32_t rv = nr->last4;
+    unsigned k = 0;
+    while(k < nr->nblocks4) {
+        const unsigned i = nr_block_rank(&nr->keys4[k * NR_B], x);
+        if(i < NR_B)
+            rv = nr->vals4[k * NR_B + i];
+        k = nr_child(k, i);
+    }
+
+    assert(rv != NN_GET_DCLIST(NN_UNDEF));
+    return rv;
+}
+
+unsigned nrange_lookup_v6(const nrange_t* nr, const uint8_t* ipv6) {
+    assert(nr); assert(ipv6);
+
+    uint32_t ipv4;
+    if(v6_v4fixup(ipv6, &ipv4))
+        return nrange_lookup_v4(nr, ipv4);
+
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    for(unsigned i = 0; i < 8; i++) {
+        hi = (hi << 8) | ipv6[i];
+        lo = (lo << 8) | ipv6[i + 8];
+    }
+
+    // descend to the first key > addr, tracking left/right turns in k
+    unsigned long long k = 1;
+    while(k <= nr->n6) {
+        __builtin_prefetch(&nr->keys6[k * 4]);
+        const nrange_key6_t* key = &nr->keys6[k];
+        const unsigned le = (key->hi < hi) | ((key->hi == hi) & (key->lo <= lo));
+        k = 2 * k + le;
+    }
+    k >>= __builtin_ffsll((long long)~k);
+
+    const uint32_t rv = k ? nr->vals6[k] : nr->last6;
+    assert(rv != NN_GET_DCLIST(NN_UNDEF));
+    return rv;
+}
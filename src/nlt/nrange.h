@@ -0,0 +1,72 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NRANGE_H
+#define NRANGE_H
+
+#include "config.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include "ntree.h"
+
+/*
+ * The finished ntree_t flattened into sorted, non-overlapping address
+ * ranges.  Each range boundary (the first address of every range except
+ * the one starting at zero) is stored along with the dclist of the range
+ * just *below* it, so a lookup is "find the first boundary > addr" and
+ * take its value, or the value of the last range if there is none.
+ *
+ * IPv4 boundaries are laid out as a static B-tree of 16-key, cache-line
+ * sized blocks (an "S-tree"), searched with SSE2 compares where available.
+ * IPv6 boundaries are 128 bits wide, which doesn't fit the SIMD compares
+ * well, so they're laid out in Eytzinger (BFS) order and searched with
+ * branch-free scalar compares and prefetching instead.
+ */
+
+#define NR_B 16U // keys per IPv4 block
+
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} nrange_key6_t;
+
+typedef struct {
+    uint32_t* keys4;      // nblocks4 * NR_B keys, sign-flipped for SSE2
+    uint32_t* vals4;      // value below each key, parallel to keys4
+    unsigned nblocks4;
+    uint32_t last4;       // value of the last ipv4 range
+    nrange_key6_t* keys6; // 1-indexed Eytzinger order, n6 + 1 entries
+    uint32_t* vals6;      // value below each key, parallel to keys6
+    unsigned n6;
+    uint32_t last6;       // value of the last ipv6 range
+} nrange_t;
+
+// tree must be finished already
+nrange_t* nrange_new(const ntree_t* tree);
+
+void nrange_destroy(nrange_t* nr);
+
+// memory used by the arrays, in bytes
+size_t nrange_size(const nrange_t* nr);
+
+// Same arguments and results as ntree_lookup_v4() and ntree_lookup_v6()
+unsigned nrange_lookup_v4(const nrange_t* nr, const uint32_t ipv4);
+unsigned nrange_lookup_v6(const nrange_t* nr, const uint8_t* ipv6);
+
+#endif // NRANGE_H
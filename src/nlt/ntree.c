@@ -25,25 +25,39 @@
 #include <stdlib.h>
 #include <string.h>
 
-// unaligned 32-bit access, copied from gdnsd's compiler.h
-struct _gdnsd_una32 { uint32_t x; } __attribute__((__packed__));
-#define gdnsd_get_una32(_p) (((const struct _gdnsd_una32*)(_p))->x)
-
-// Initial node allocation count,
-//   must be power of two due to alloc code,
+// Initial node allocation count when the caller has no better idea
 static const unsigned NT_SIZE_INIT = 128;
 
-ntree_t* ntree_new(void) {
+// The per-bit assertions in the lookup walks cost more than the rest of
+//   the loop body, so they're only compiled in with NTREE_HOT_ASSERTS
+//   (configure --enable-hot-asserts), even when NDEBUG is not defined.
+#ifdef NTREE_HOT_ASSERTS
+#  define HOT_ASSERT(x) assert(x)
+#else
+#  define HOT_ASSERT(x) do { } while(0)
+#endif
+
+// Layout of the finished store, see ntree_relayout():
+// Nodes in the top block, laid out breadth-first from the root
+static const unsigned NT_TOP_NODES = 512;
+// Nodes per cache line, and per block below the top one
+#define NT_LINE_NODES (64U / sizeof(nnode_t))
+
+ntree_t* ntree_new(const unsigned size_hint) {
+    const unsigned alloc = size_hint ? size_hint : NT_SIZE_INIT;
     ntree_t* newtree = malloc(sizeof(ntree_t));
-    newtree->store = malloc(NT_SIZE_INIT * sizeof(nnode_t));
+    newtree->store = malloc(alloc * sizeof(nnode_t));
+    newtree->root = 0;
     newtree->count = 0;
-    newtree->alloc = NT_SIZE_INIT; // set to zero on fixation
+    newtree->alloc = alloc; // set to zero on fixation
+    newtree->borrowed = false;
     return newtree;
 }
 
 void ntree_destroy(ntree_t* tree) {
     assert(tree);
-    free(tree->store);
+    if(!tree->borrowed)
+        free(tree->store);
     free(tree);
 }
 
@@ -68,7 +82,7 @@ unsigned ntree_add_node(ntree_t* tree) {
 static unsigned ntree_find_v4root(const ntree_t* tree) {
     assert(tree);
 
-    unsigned offset = 0;
+    unsigned offset = tree->root;
     unsigned mask_depth = 96;
     do {
         assert(offset < tree->count);
@@ -78,81 +92,300 @@ static unsigned ntree_find_v4root(const ntree_t* tree) {
     return offset;
 }
 
+// Appends one block to the new layout: up to "limit" nodes breadth-first
+//   from "root".  Interior children that didn't fit in the block are
+//   pushed on "stack" as roots of later blocks.
+static void ntree_place_block(const ntree_t* tree, const unsigned root, const unsigned limit, unsigned* order, unsigned* placed, unsigned* stack, unsigned* sdepth) {
+    const unsigned first = *placed;
+    order[(*placed)++] = root;
+    for(unsigned i = first; i < *placed; i++) {
+        const nnode_t* node = &tree->store[order[i]];
+        for(unsigned b = 0; b < 2; b++) {
+            const uint32_t child = node->branch[b];
+            if(NN_IS_DCLIST(child))
+                continue;
+            if(*placed - first < limit)
+                order[(*placed)++] = child;
+            else
+                stack[(*sdepth)++] = child;
+        }
+    }
+}
+
+// The store comes out of nlist_xlate_tree() in depth-first build order,
+//   so a walk jumps between distant cache lines on nearly every bit.  This
+//   rewrites it so that the top levels (which every lookup walks) are one
+//   dense breadth-first block at the start of the store, and everything
+//   below is cut into cache-line-sized blocks, each holding a small
+//   breadth-first subtree, so that a walk touches about one new line per
+//   NT_LINE_NODES levels on chains and three on full subtrees.  Blocks
+//   are emitted depth-first, so a subtree's blocks also stay close.
+//   The root ends up at index zero.
+nnode_t* ntree_compact(const ntree_t* tree, const unsigned spare, unsigned* count_p) {
+    assert(tree); assert(count_p);
+    assert(tree->root < tree->count);
+    const unsigned count = tree->count;
+
+    unsigned* order = malloc(count * sizeof(unsigned)); // new -> old
+    unsigned* stack = malloc(count * sizeof(unsigned));
+    unsigned placed = 0;
+    unsigned sdepth = 0;
+
+    ntree_place_block(tree, tree->root, NT_TOP_NODES, order, &placed, stack, &sdepth);
+    while(sdepth)
+        ntree_place_block(tree, stack[--sdepth], NT_LINE_NODES, order, &placed, stack, &sdepth);
+    assert(placed <= count);
+    assert(placed + spare < (1U << 24));
+
+    // re-use "stack" as the inverse map, old -> new, for placed nodes
+    unsigned* newidx = stack;
+    for(unsigned i = 0; i < placed; i++)
+        newidx[order[i]] = i;
+
+    void* mem = NULL;
+    if(posix_memalign(&mem, 64, (placed + spare) * sizeof(nnode_t)))
+        abort();
+    nnode_t* store = mem;
+    for(unsigned i = 0; i < placed; i++) {
+        const nnode_t* old = &tree->store[order[i]];
+        for(unsigned b = 0; b < 2; b++)
+            store[i].branch[b] = NN_IS_DCLIST(old->branch[b])
+                ? old->branch[b]
+                : newidx[old->branch[b]];
+    }
+
+    free(order);
+    free(newidx);
+    *count_p = placed;
+    return store;
+}
+
 void ntree_finish(ntree_t* tree) {
     assert(tree);
+    assert(!tree->borrowed);
     tree->alloc = 0; // flag fixed, will fail asserts on add_node, etc now
-    tree->store = realloc(tree->store, tree->count * sizeof(nnode_t));
+    unsigned count;
+    nnode_t* store = ntree_compact(tree, 0, &count);
+    assert(count == tree->count); // the builders leave no garbage
+    free(tree->store);
+    tree->store = store;
+    tree->root = 0;
     tree->ipv4 = ntree_find_v4root(tree);
 }
 
-static inline bool CHKBIT_v6(const uint8_t* ipv6, const unsigned bit) {
-    assert(ipv6);
-    assert(bit < 128);
-    return ipv6[bit >> 3] & (1UL << (~bit & 7));
+void ntree_set_root(ntree_t* tree, const unsigned root) {
+    assert(tree);
+    assert(root < tree->count);
+    tree->root = root;
+    tree->ipv4 = ntree_find_v4root(tree);
+}
+
+// The v4-like spaces, which lookups translate to IPv4 before walking the
+//   tree, so that their NN_UNDEF leaves are never reached
+static const struct {
+    const uint8_t* addr;
+    unsigned len;
+} v4like[4] = {
+    { start_v4mapped, 96U },
+    { start_siit, 96U },
+    { start_teredo, 32U },
+    { start_6to4, 16U },
+};
+
+// Per-node state for ntree_from_store(): which v4like[] prefixes (by bit)
+//   the node's own prefix is still on the way to, or that it's within one
+#define V4L_INSIDE (1U << 4U)
+#define V4L_SEEN (1U << 7U)
+
+// The state of a parent's child on side "b" of the parent's "bit"
+static unsigned v4like_step(const unsigned st, const unsigned bit, const unsigned b) {
+    unsigned rv = st & V4L_INSIDE;
+    for(unsigned c = 0; c < 4; c++) {
+        if(!(st & (1U << c)))
+            continue;
+        if(((v4like[c].addr[bit >> 3] >> (~bit & 7U)) & 1U) != b)
+            continue;
+        rv |= (bit + 1U == v4like[c].len) ? V4L_INSIDE : (1U << c);
+    }
+    return rv;
 }
 
-static unsigned ntree_lookup_v6(const ntree_t* tree, const uint8_t* ip) {
+ntree_t* ntree_from_store(nnode_t* store, const unsigned count, const unsigned dclists) {
+    assert(store || !count);
+
+    if(!count || count >= (1U << 24))
+        return NULL;
+
+    // node depths, which only ever grow as a parent is visited, as all
+    //   parents come before their children.  The v4-like state is only
+    //   inside a space if it is on every path to the node.
+    uint8_t* depth = calloc(count, 1);
+    uint8_t* v4l = calloc(count, 1);
+    v4l[0] = V4L_SEEN | 0xFU;
+    bool ok = true;
+    for(unsigned i = 0; ok && i < count; i++) {
+        for(unsigned b = 0; b < 2; b++) {
+            const uint32_t child = store[i].branch[b];
+            const unsigned st = v4like_step(v4l[i], depth[i], b);
+            if(NN_IS_DCLIST(child)) {
+                // NN_UNDEF elsewhere would be handed out as a string index
+                if(child == NN_UNDEF ? !(st & V4L_INSIDE) : NN_GET_DCLIST(child) >= dclists)
+                    ok = false;
+            }
+            else if(child <= i || child >= count || depth[i] >= 127) {
+                ok = false;
+            }
+            else {
+                if(depth[child] < depth[i] + 1)
+                    depth[child] = depth[i] + 1;
+                v4l[child] = V4L_SEEN | ((v4l[child] & V4L_SEEN) ? (v4l[child] & st) : st);
+            }
+        }
+    }
+    free(v4l);
+    free(depth);
+
+    if(!ok)
+        return NULL;
+
+    ntree_t* tree = malloc(sizeof(ntree_t));
+    tree->store = store;
+    tree->root = 0;
+    tree->count = count;
+    tree->alloc = 0;
+    tree->borrowed = true;
+    tree->ipv4 = ntree_find_v4root(tree);
+    return tree;
+}
+
+// The walks below pick the next node by indexing nnode_t.branch[] with the
+//   address bit, rather than branching on it, as the bit is effectively
+//   random and a mispredict costs about as much as the load itself.
+
+static unsigned ntree_walk_v6(const ntree_t* tree, const uint8_t* ip) {
     assert(tree); assert(ip);
 
     unsigned chkbit = 0;
-    unsigned offset = 0;
+    unsigned offset = tree->root;
     do {
-        assert(offset < tree->count);
+        HOT_ASSERT(offset < tree->count);
         const nnode_t* current = &tree->store[offset];
-        assert(current->one && current->zero);
-        offset = CHKBIT_v6(ip, chkbit++) ? current->one : current->zero;
-        assert(chkbit < 129);
+        HOT_ASSERT(current->one && current->zero);
+        offset = current->branch[(ip[chkbit >> 3] >> (~chkbit & 7)) & 1];
+        chkbit++;
+        HOT_ASSERT(chkbit < 129);
     } while(!NN_IS_DCLIST(offset));
 
     assert(offset != NN_UNDEF); // the special v4-like undefined areas
     return NN_GET_DCLIST(offset);
 }
 
-static inline bool CHKBIT_v4(const uint32_t ip, const unsigned maskbit) {
-    assert(maskbit < 32U);
-    return ip & (1U << (31U - maskbit));
-}
-
-static unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ip) {
+static unsigned ntree_walk_v4(const ntree_t* tree, const uint32_t ip) {
     assert(tree); assert(tree->ipv4);
 
     unsigned chkbit = 0;
     unsigned offset = tree->ipv4;
     while(!NN_IS_DCLIST(offset)) {
-        assert(offset < tree->count);
+        HOT_ASSERT(offset < tree->count);
         const nnode_t* current = &tree->store[offset];
-        assert(current->one && current->zero);
-        offset = CHKBIT_v4(ip, chkbit++) ? current->one : current->zero;
-        assert(chkbit < 33);
+        HOT_ASSERT(current->one && current->zero);
+        offset = current->branch[(ip >> (31U - chkbit)) & 1];
+        chkbit++;
+        HOT_ASSERT(chkbit < 33);
     }
 
     assert(offset != NN_UNDEF); // the special v4-like undefined areas
     return NN_GET_DCLIST(offset);
 }
 
-// if "addr" is in any v4-compatible spaces other than
-//   v4compat (our canonical one), convert to v4compat.
-// returns address zero if no conversion
-static uint32_t v6_v4fixup(const uint8_t* in) {
-    assert(in);
+unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ipv4) {
+    assert(tree);
+    assert(!tree->alloc); // ntree_finish() was called
+    assert(tree->ipv4); // must be a non-zero node offset or a dclist w/ high-bit set
+    return ntree_walk_v4(tree, ipv4);
+}
+
+unsigned ntree_lookup_v6(const ntree_t* tree, const uint8_t* ipv6) {
+    assert(tree); assert(ipv6);
+    assert(!tree->alloc); // ntree_finish() was called
+    assert(tree->ipv4); // must be a non-zero node offset or a dclist w/ high-bit set
 
-    uint32_t ip_out = 0;
+    unsigned rv;
 
-    if(!memcmp(in, start_v4mapped, 12) || !memcmp(in, start_siit, 12))
-        ip_out = ntohl(gdnsd_get_una32(&in[12]));
-    else if(!memcmp(in, start_teredo, 4))
-        ip_out = ntohl(gdnsd_get_una32(&in[12]) ^ 0xFFFFFFFF);
-    else if(!memcmp(in, start_6to4, 2))
-        ip_out = ntohl(gdnsd_get_una32(&in[2]));
+    uint32_t ipv4;
+    if(v6_v4fixup(ipv6, &ipv4))
+        rv = ntree_walk_v4(tree, ipv4);
+    else
+        rv = ntree_walk_v6(tree, ipv6);
 
-    return ip_out;
+    return rv;
 }
 
-unsigned ntree_lookup(const ntree_t* tree, const struct sockaddr* sa) {
-    assert(tree); assert(sa);
+// Lanes walked in lockstep by ntree_lookup_batch().  Enough to keep the
+//   line fill buffers busy, few enough that the lane state stays in
+//   registers and L1.
+#define NT_BATCH_LANES 8U
+
+void ntree_lookup_batch(const ntree_t* tree, const unsigned n, const uint8_t* addrs, unsigned* results) {
+    assert(tree); assert(addrs || !n); assert(results || !n);
     assert(!tree->alloc); // ntree_finish() was called
     assert(tree->ipv4); // must be a non-zero node offset or a dclist w/ high-bit set
 
+    for(unsigned base = 0; base < n; base += NT_BATCH_LANES) {
+        const unsigned lanes = (n - base) < NT_BATCH_LANES ? (n - base) : NT_BATCH_LANES;
+
+        // per-lane walk state
+        const uint8_t* ip6[NT_BATCH_LANES];
+        uint32_t ip4[NT_BATCH_LANES];
+        bool is4[NT_BATCH_LANES];
+        uint32_t offset[NT_BATCH_LANES];
+        unsigned chkbit[NT_BATCH_LANES];
+        unsigned active[NT_BATCH_LANES]; // lane numbers still walking
+        unsigned nactive = 0;
+
+        for(unsigned l = 0; l < lanes; l++) {
+            ip6[l] = &addrs[(base + l) * 16];
+            is4[l] = v6_v4fixup(ip6[l], &ip4[l]);
+            offset[l] = is4[l] ? tree->ipv4 : tree->root;
+            chkbit[l] = 0;
+            if(NN_IS_DCLIST(offset[l])) {
+                // only possible for the v4 root
+                results[base + l] = NN_GET_DCLIST(offset[l]);
+            }
+            else {
+                __builtin_prefetch(&tree->store[offset[l]]);
+                active[nactive++] = l;
+            }
+        }
+
+        while(nactive) {
+            for(unsigned j = 0; j < nactive; ) {
+                const unsigned l = active[j];
+                const unsigned bit = chkbit[l]++;
+                HOT_ASSERT(offset[l] < tree->count);
+                const nnode_t* current = &tree->store[offset[l]];
+                const unsigned dir = is4[l]
+                    ? (ip4[l] >> (31U - bit)) & 1
+                    : (ip6[l][bit >> 3] >> (~bit & 7)) & 1;
+                const uint32_t next = current->branch[dir];
+                if(NN_IS_DCLIST(next)) {
+                    assert(next != NN_UNDEF); // the special v4-like undefined areas
+                    results[base + l] = NN_GET_DCLIST(next);
+                    active[j] = active[--nactive]; // retire the lane
+                }
+                else {
+                    __builtin_prefetch(&tree->store[next]);
+                    offset[l] = next;
+                    j++;
+                }
+            }
+        }
+    }
+}
+
+unsigned ntree_lookup(const ntree_t* tree, const struct sockaddr* sa) {
+    assert(tree); assert(sa);
+
     unsigned rv;
 
     if(sa->sa_family == AF_INET) {
@@ -162,15 +395,8 @@ unsigned ntree_lookup(const ntree_t* tree, const struct sockaddr* sa) {
     else {
         assert(sa->sa_family == AF_INET6);
         const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)sa;
-        const uint32_t ipv4 = v6_v4fixup(sin6->sin6_addr.s6_addr);
-        if(ipv4) {
-            rv = ntree_lookup_v4(tree, ipv4);
-        }
-        else {
-            rv = ntree_lookup_v6(tree, sin6->sin6_addr.s6_addr);
-        }
+        rv = ntree_lookup_v6(tree, sin6->sin6_addr.s6_addr);
     }
 
     return rv;
 }
-
@@ -22,7 +22,9 @@
 
 #include "config.h"
 #include <inttypes.h>
+#include <stdbool.h>
 #include <assert.h>
+#include <string.h>
 #include <netinet/in.h>
 
 /***************************************
@@ -37,6 +39,10 @@ static inline void SETBIT_v6(uint8_t* ipv6, const unsigned bit) {
     ipv6[bit >> 3] |= (1UL << (~bit & 7));
 }
 
+// unaligned 32-bit access, copied from gdnsd's compiler.h
+struct _gdnsd_una32 { uint32_t x; } __attribute__((__packed__));
+#define gdnsd_get_una32(_p) (((const struct _gdnsd_una32*)(_p))->x)
+
 // Some constant IPv6 address fragments...
 
 // 96-bit prefix
@@ -77,6 +83,27 @@ static const uint8_t start_teredo[16] =
 // zero-initializer for IPv6
 static const struct in6_addr ip6_zero = { .s6_addr = { 0 } };
 
+// if "addr" is in any v4-compatible spaces other than
+//   v4compat (our canonical one), convert to v4compat.
+// returns false if no conversion.  (The result alone can't signal that,
+//   as e.g. ::ffff:0.0.0.0 legitimately converts to 0.0.0.0)
+static inline bool v6_v4fixup(const uint8_t* in, uint32_t* out) {
+    assert(in); assert(out);
+
+    bool rv = true;
+
+    if(!memcmp(in, start_v4mapped, 12) || !memcmp(in, start_siit, 12))
+        *out = ntohl(gdnsd_get_una32(&in[12]));
+    else if(!memcmp(in, start_teredo, 4))
+        *out = ntohl(gdnsd_get_una32(&in[12]) ^ 0xFFFFFFFF);
+    else if(!memcmp(in, start_6to4, 2))
+        *out = ntohl(gdnsd_get_una32(&in[2]));
+    else
+        rv = false;
+
+    return rv;
+}
+
 /*
  * This is our network/mask database.  It becomes fully populated, in that
  * a lookup of any address *will* find a node.  This is because the original
@@ -103,30 +130,74 @@ static const struct in6_addr ip6_zero = { .s6_addr = { 0 } };
 #define NN_GET_DCLIST(x) ((x) & ~(1U << 31U)) // strips high bit
 #define NN_SET_DCLIST(x) ((x) | (1U << 31U)) // sets high bit
 
-typedef struct {
-    uint32_t zero;
-    uint32_t one;
+typedef union {
+    struct {
+        uint32_t zero;
+        uint32_t one;
+    };
+    uint32_t branch[2]; // the same two, indexed by bit value
 } nnode_t;
 
 typedef struct {
-    nnode_t* store;
+    nnode_t* store; // 64-byte aligned after _finish()
+    unsigned root;  // zero, except for trees updated in place by
+                    //   nlist_xlate_update(), which share their store
     unsigned ipv4;  // cached ipv4 lookup hint
     unsigned count; // raw nodes, including interior ones
     unsigned alloc; // current allocation of store during construction,
                     //   set to zero after _finish()
+    bool borrowed;  // store belongs to someone else (e.g. an mmap()),
+                    //   ntree_destroy() leaves it alone
 } ntree_t;
 
-ntree_t* ntree_new(void);
+// "size_hint" is the initial node allocation, which ntree_add_node()
+//   only has to grow if it's exceeded (zero for a small default).
+ntree_t* ntree_new(const unsigned size_hint);
 
 void ntree_destroy(ntree_t* tree);
 
 // keeps ->count up-to-date and resizes storage
-//   as necc by doubling.
+//   as necc by doubling, if the size hint was short.
 unsigned ntree_add_node(ntree_t* tree);
 
-// call this after done adding data
+// call this after done adding data.  This also re-lays-out the store
+//   for lookup locality (see ntree.c), so node indices from before the
+//   call are not valid afterwards.
 void ntree_finish(ntree_t* tree);
 
+// Copies the nodes reachable from tree's root into a new 64-byte aligned
+//   store in the layout ntree_finish() gives (root at index zero), with
+//   room for "spare" more nodes after them, and sets *count_p to the
+//   number copied.  This drops any nodes that updates left unreachable.
+nnode_t* ntree_compact(const ntree_t* tree, const unsigned spare, unsigned* count_p);
+
+// Points a tree at a new root node within its store, and refreshes the
+//   ipv4 hint to match.
+void ntree_set_root(ntree_t* tree, const unsigned root);
+
+// Wraps an already-finished store from elsewhere, e.g. a compiled database
+//   file, without copying it.  The store is checked to be a tree that the
+//   lookups can walk safely (every child after its parent and in bounds,
+//   no walk deeper than 128 bits, and every dclist below "dclists", or
+//   NN_UNDEF within the v4-like spaces that lookups never walk into),
+//   and NULL is returned if it isn't.  "store" must stay valid
+//   for the life of the tree and is not freed by ntree_destroy().
+ntree_t* ntree_from_store(nnode_t* store, const unsigned count, const unsigned dclists);
+
 unsigned ntree_lookup(const ntree_t* tree, const struct sockaddr* sa);
 
+// Direct lookups on raw address bytes, for callers that have already
+//   parsed the address themselves.  ipv4 is in host byte order, ipv6
+//   is a uint8_t[16] in network order.  The v6 variant does the same
+//   v4-like space translation as ntree_lookup().
+unsigned ntree_lookup_v4(const ntree_t* tree, const uint32_t ipv4);
+unsigned ntree_lookup_v6(const ntree_t* tree, const uint8_t* ipv6);
+
+// Looks up "n" addresses at once.  addrs holds n uint8_t[16] IPv6 addresses
+//   back to back (IPv4 as ::ffff:a.b.c.d or any other v4-like form), and
+//   results[i] gets what ntree_lookup_v6() would return for each.  The
+//   walks advance in lockstep with a prefetch of every lane's next node,
+//   so their cache misses overlap instead of adding up.
+void ntree_lookup_batch(const ntree_t* tree, const unsigned n, const uint8_t* addrs, unsigned* results);
+
 #endif // NTREE_H
@@ -19,9 +19,12 @@
 
 #define _GNU_SOURCE
 #include "cache/cache.h"
+#include "vsa.h"
 #include "vcc_if.h"
 
 #include <stdbool.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -30,107 +33,398 @@
 #include <stdio.h>
 
 #include <pthread.h>
-#define _LGPL_SOURCE 1
-#include <urcu-qsbr.h>
 
 #include "vnm.h"
+#include "vnm_cache.h"
+#include "vnm_rcu.h"
+#include "vnm_sched.h"
+#include "vnm_watch.h"
+
+// Databases come from either init() (found by label at runtime through a
+//   small hash index in the PRIV_VCL, rebuilt whenever init() adds one),
+//   or from a db object (bound at VCL compile time, no lookup at all).
+//   Either way, the file itself is loaded and kept up to date by a shared
+//   vnm_src_t, of which there's one per file and set of load options in
+//   the whole process, no matter how many labels and objects in how many
+//   VCLs (e.g. warm ones kept around after vcl.use) refer to it, or by
+//   which spelling of its path (see src_path_key()).
+
+typedef struct _vnm_src {
+    struct _vnm_src* next; // in vnm_srcs
+    char* fn;
+    char* key; // src_path_key() of fn
+    vnm_opts_t opts; // cache and pin are per-user, and not set here
+    unsigned reload_check_interval; // the shortest of any user's
+    unsigned users; // these two protected by vnm_srcs_lock
+    unsigned* intervals; // each user's reload_check_interval
+    vnm_rcu_t rcu;
+    vnm_db_t* db;
+    vnm_watch_t* watch;
+    vnm_sched_job_t* job;
+    unsigned retry_ms; // only touched by the job
+    pthread_mutex_t lock; // serializes reload checks
+    struct stat db_stat;
+} vnm_src_t;
 
-// note, the set of databases is indexed at runtime by a text
-//  label, and we just iterate strcmp to look them up.  If anyone
-//  actually has a lot of databases and cares, please submit a patch that
-//  implements a hashtable for them!
+static pthread_mutex_t vnm_srcs_lock = PTHREAD_MUTEX_INITIALIZER;
+static vnm_src_t* vnm_srcs = NULL;
 
 typedef struct {
+    char* label; // or the VCL object name
+    unsigned label_hash;
+    vnm_opts_t opts;
     unsigned reload_check_interval;
-    char* label;
-    char* fn;
-    vnm_db_t* db;
-    pthread_t updater;
-    struct stat db_stat;
+    vnm_src_t* src;
 } vnm_db_file_t;
 
 typedef struct {
     unsigned db_count;
     vnm_db_file_t** dbs;
+    vnm_db_file_t** index; // open addressing by label_hash, NULL for empty
+    unsigned index_mask;
 } vnm_priv_t;
 
+struct vmod_netmapper_db {
+    unsigned magic;
+#define VMOD_NETMAPPER_DB_MAGIC 0x4e4d4442
+    vnm_db_file_t* dbf;
+};
+
+// Largest "cache=N" option of any database, across all VCLs
+static unsigned cache_entries_max = 0;
+
 // Copy a str_t*'s data to a const char* in the session workspace,
 //   so that after return we're not holding references to data in
 //   the vnm db, so that it can be swapped for update between...
 static const char* vnm_str_to_vcl(const struct vrt_ctx *ctx, const vnm_str_t* str) {
     char* rv = NULL;
-    struct vsl_log *vsl;
 
     CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 
     if(str->data) {
         rv = WS_Alloc(ctx->ws, str->len);
         if(!rv)
-            VSLb(vsl, SLT_Error, "vmod_netmapper: no space for string retval!");
+            VSL(SLT_Error, 0, "vmod_netmapper: no space for string retval!");
         else
             memcpy(rv, str->data, str->len);
     }
     return rv;
 }
 
-static void* updater_start(void* dbf_asvoid) {
-    vnm_db_file_t* dbf = dbf_asvoid;
-    struct stat check_stat;
+static void db_unref_deferred(void* db_asvoid) {
+    vnm_db_unref(db_asvoid);
+}
 
-    pthread_setname_np(pthread_self(), "netmap");
+// Publishes "new_db" and retires the one it replaces, which the reclaimer
+//   frees once no reader can still be using it (other than through its
+//   own references).  Doesn't wait for that, so a slow reader holds up
+//   only the memory, not the next reload.
+static void src_swap(vnm_src_t* src, vnm_db_t* new_db) {
+    vnm_db_t* old_db = src->db;
+    vnm_rcu_assign_pointer(src->db, new_db);
+    if(old_db)
+        vnm_rcu_defer(&src->rcu, db_unref_deferred, old_db);
+}
 
-    while(1) {
-        sleep(dbf->reload_check_interval);
-        if(stat(dbf->fn, &check_stat)) {
-            VSL(SLT_Error, 0, "vmod_netmapper: Failed to stat JSON database '%s' for reload check", dbf->fn);
-            continue;
-        }
+// One reload check: (re-)loads the database if the file changed, or else
+//   applies its delta file if it has one.  true retval means a load failed
+//   and should be retried soon.
+static bool src_check(vnm_src_t* src) {
+    bool failed = false;
+    struct stat check_stat;
 
-        if(    check_stat.st_mtime != dbf->db_stat.st_mtime
-            || check_stat.st_ctime != dbf->db_stat.st_ctime
-            || check_stat.st_ino   != dbf->db_stat.st_ino
-            || check_stat.st_dev   != dbf->db_stat.st_dev) {
+    pthread_mutex_lock(&src->lock);
 
-            // this is just to prevent resource leaks on pthread_cancel
-            //   racing a reload, nothing to do with the rcu stuff.
-            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if(stat(src->fn, &check_stat)) {
+        VSL(SLT_Error, 0, "vmod_netmapper: Failed to stat database '%s' for reload check", src->fn);
+        failed = true;
+    }
+    else {
+        bool reload = (
+               check_stat.st_mtime != src->db_stat.st_mtime
+            || check_stat.st_ctime != src->db_stat.st_ctime
+            || check_stat.st_ino   != src->db_stat.st_ino
+            || check_stat.st_dev   != src->db_stat.st_dev
+        );
+
+        // with an unchanged database, just what was added to its delta file
+        if(!reload && src->opts.delta && src->db) {
+            vnm_db_t* new_db = vnm_db_update(src->db, &reload);
+            if(new_db) {
+                src_swap(src, new_db);
+                VSL(SLT_CLI, 0, "vmod_netmapper: database '%s' updated from its delta file (generation %" PRIu64 ")", src->fn, vnm_db_generation(new_db)); // CLI??
+            }
+        }
 
-            vnm_db_t* new_db = vnm_db_parse(dbf->fn, &dbf->db_stat);
+        if(reload) {
+            vnm_db_t* new_db = vnm_db_parse(src->fn, &src->db_stat, &src->opts);
             if(new_db) {
-                vnm_db_t* old_db = dbf->db;
-                rcu_assign_pointer(dbf->db, new_db);
-                synchronize_rcu();
-                if(old_db)
-                    vnm_db_destruct(old_db);
-                VSL(SLT_CLI, 0, "vmod_netmapper: JSON database '%s' (re-)loaded with new data", dbf->fn); // CLI??
+                src_swap(src, new_db);
+                VSL(SLT_CLI, 0, "vmod_netmapper: database '%s' (re-)loaded with new data (generation %" PRIu64 ")", src->fn, vnm_db_generation(new_db)); // CLI??
             }
             else {
-                VSL(SLT_Error, 0, "vmod_netmapper: JSON database '%s' reload failed, continuing with old data", dbf->fn);
+                VSL(SLT_Error, 0, "vmod_netmapper: database '%s' reload failed, continuing with old data", src->fn);
+                failed = true;
             }
-
-            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
         }
     }
 
-    return NULL;
+    pthread_mutex_unlock(&src->lock);
+    return failed;
 }
 
-static void per_vcl_fini(void* vp_asvoid) {
-    vnm_priv_t* vp = vp_asvoid;
+// The first retry after a failed load comes this soon, and each further
+//   one twice as late, up to the check interval
+#define VNM_RETRY_MIN_MS 250U
+
+static unsigned retry_backoff(const unsigned retry_ms, const unsigned interval_ms) {
+    if(!retry_ms)
+        return VNM_RETRY_MIN_MS < interval_ms ? VNM_RETRY_MIN_MS : interval_ms;
+    return retry_ms < interval_ms >> 1 ? retry_ms << 1 : interval_ms;
+}
+
+static unsigned src_interval_ms(vnm_src_t* src) {
+    // changes as users come and go
+    const uint64_t ms = (uint64_t)__atomic_load_n(&src->reload_check_interval, __ATOMIC_RELAXED) * 1000U;
+    return ms > INT_MAX ? INT_MAX : (unsigned)ms;
+}
+
+// The scheduler job: runs whenever the watch says the files may have
+//   changed, and at least every check interval regardless
+static unsigned src_job(void* src_asvoid) {
+    vnm_src_t* src = src_asvoid;
+    const unsigned interval_ms = src_interval_ms(src);
+    if(src->retry_ms > interval_ms)
+        src->retry_ms = interval_ms;
+    src->retry_ms = src_check(src) ? retry_backoff(src->retry_ms, interval_ms) : 0;
+    return src->retry_ms ? src->retry_ms : interval_ms;
+}
+
+// The options that shape the loaded database.  build_threads doesn't, and
+//   a shared source keeps the first user's.
+static bool src_opts_eq(const vnm_opts_t* a, const vnm_opts_t* b) {
+    return a->engine == b->engine
+        && a->v4table_bits == b->v4table_bits
+        && a->delta == b->delta
+        && !strcmp(a->mmdb_key, b->mmdb_key);
+}
+
+// The path that sources are keyed by: made absolute, with empty and "."
+//   components dropped.  That's purely textual, so spellings that only
+//   meet through a symlink stay apart, as they must: the source watches
+//   and reloads its own path, and a symlink may be pointed elsewhere at
+//   any time (e.g. "current.json" -> "v2.json" while another user names
+//   "v1.json").  ".." is kept as is for the same reason.
+static char* src_path_key(const char* path) {
+    char cwd[PATH_MAX];
+    const bool rel = path[0] != '/';
+    if(rel && !getcwd(cwd, sizeof(cwd)))
+        return strdup(path);
+    const size_t cwd_len = rel ? strlen(cwd) : 0;
+    char* key = malloc(cwd_len + strlen(path) + 2U);
+    if(rel)
+        memcpy(key, cwd, cwd_len);
+    size_t len = cwd_len;
+
+    const char* p = path;
+    while(*p) {
+        while(*p == '/')
+            p++;
+        const char* comp = p;
+        while(*p && *p != '/')
+            p++;
+        const size_t comp_len = (size_t)(p - comp);
+        if(!comp_len || (comp_len == 1 && comp[0] == '.'))
+            continue;
+        key[len++] = '/';
+        memcpy(&key[len], comp, comp_len);
+        len += comp_len;
+    }
+    // a trailing slash makes it a different (and failing) path
+    if(!len || (p > path && p[-1] == '/'))
+        key[len++] = '/';
+    key[len] = '\0';
+    return key;
+}
+
+// The shortest check interval of the source's users
+static void src_interval_update(vnm_src_t* src) {
+    unsigned interval = src->intervals[0];
+    for(unsigned i = 1; i < src->users; i++)
+        if(src->intervals[i] < interval)
+            interval = src->intervals[i];
+    __atomic_store_n(&src->reload_check_interval, interval, __ATOMIC_RELAXED);
+}
+
+// Finds or creates the source for "path" and the load options in "opts".
+//   A new one does the initial load and registers with the scheduler, and an
+//   existing one gets a reload check first, so that a new VCL never starts
+//   out with data older than the file.
+static vnm_src_t* src_get(const char* path, const unsigned interval, const vnm_opts_t* opts) {
+    char* key = src_path_key(path);
+
+    pthread_mutex_lock(&vnm_srcs_lock);
+
+    vnm_src_t* src = vnm_srcs;
+    while(src && (strcmp(src->key, key) || !src_opts_eq(&src->opts, opts)))
+        src = src->next;
+
+    if(src) {
+        free(key);
+        src->intervals = realloc(src->intervals, (src->users + 1U) * sizeof(unsigned));
+        src->intervals[src->users++] = interval;
+        const bool hurry = interval < src->reload_check_interval;
+        if(hurry)
+            src_interval_update(src);
+        pthread_mutex_unlock(&vnm_srcs_lock);
+        src_check(src);
+        if(hurry)
+            vnm_sched_hurry(src->job, src_interval_ms(src));
+        return src;
+    }
+
+    // VCL loads are serialized anyway, so the initial load is done under
+    //   the registry lock, rather than having to deal with a racing one
+    src = calloc(1, sizeof(vnm_src_t));
+    src->fn = strdup(path);
+    src->key = key;
+    src->opts = *opts;
+    src->opts.cache_entries = 0;
+    src->opts.pin_task = false;
+    src->reload_check_interval = interval;
+    src->users = 1;
+    src->intervals = malloc(sizeof(unsigned));
+    src->intervals[0] = interval;
+    vnm_rcu_init(&src->rcu);
+    pthread_mutex_init(&src->lock, NULL);
+    src->watch = vnm_watch_new(src->fn, opts->delta);
+
+    // the job's watch is in place before the initial load, so that no
+    //   change after it is missed, and a run in the meantime waits for it
+    const unsigned interval_ms = src_interval_ms(src);
+    pthread_mutex_lock(&src->lock);
+    src->job = vnm_sched_add(src_job, src, src->watch, interval_ms);
+    src->db = vnm_db_parse(src->fn, &src->db_stat, &src->opts);
+    pthread_mutex_unlock(&src->lock);
+    if(!src->db) {
+        VSL(SLT_Error, 0, "vmod_netmapper: Failed initial load of netmapper database %s (will keep trying periodically)", src->fn);
+        vnm_sched_hurry(src->job, retry_backoff(0, interval_ms));
+    }
+
+    src->next = vnm_srcs;
+    vnm_srcs = src;
+    pthread_mutex_unlock(&vnm_srcs_lock);
+    return src;
+}
+
+// Drops a user with check interval "interval".  The others may be fine
+//   with longer ones, which the job picks up after its next run.
+static void src_put(vnm_src_t* src, const unsigned interval) {
+    pthread_mutex_lock(&vnm_srcs_lock);
+    unsigned i = 0;
+    while(src->intervals[i] != interval)
+        i++;
+    src->intervals[i] = src->intervals[--src->users];
+    const bool last = !src->users;
+    if(!last) {
+        src_interval_update(src);
+    }
+    else {
+        vnm_src_t** link = &vnm_srcs;
+        while(*link != src)
+            link = &(*link)->next;
+        *link = src->next;
+    }
+    pthread_mutex_unlock(&vnm_srcs_lock);
+
+    if(!last)
+        return;
+
+    // no more reload checks once this returns
+    vnm_sched_remove(src->job);
+    vnm_watch_destroy(src->watch);
+    pthread_mutex_destroy(&src->lock);
+
+    // free the most-recent data, and let anything retired which still
+    //   refers to src->rcu go first
+    if(src->db)
+        vnm_db_unref(src->db);
+    vnm_rcu_barrier();
+    free(src->intervals);
+    free(src->key);
+    free(src->fn);
+    free(src);
+}
+
+// FNV-1a
+static unsigned label_hash(const char* label) {
+    unsigned h = 2166136261U;
+    while(*label) {
+        h ^= (unsigned char)*label++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// Sized for a load factor of at most 1/2.  On duplicate labels the first
+//   init() wins, as it always has.
+static void vp_index_rebuild(vnm_priv_t* vp) {
+    unsigned size = 4;
+    while(size < vp->db_count * 2)
+        size <<= 1;
+
+    free(vp->index);
+    vp->index = calloc(size, sizeof(vnm_db_file_t*));
+    vp->index_mask = size - 1;
 
     for(unsigned i = 0; i < vp->db_count; i++) {
-        // clean up the updater thread
-        pthread_cancel(vp->dbs[i]->updater);
-        pthread_join(vp->dbs[i]->updater, NULL);
+        vnm_db_file_t* dbf = vp->dbs[i];
+        unsigned slot = dbf->label_hash & vp->index_mask;
+        while(vp->index[slot] && strcmp(vp->index[slot]->label, dbf->label))
+            slot = (slot + 1) & vp->index_mask;
+        if(!vp->index[slot])
+            vp->index[slot] = dbf;
+    }
+}
 
-        // free the most-recent data
-        if(vp->dbs[i]->db)
-            vnm_db_destruct(vp->dbs[i]->db);
-        free(vp->dbs[i]->fn);
-        free(vp->dbs[i]->label);
-        free(vp->dbs[i]);
+static vnm_db_file_t* vp_find(const vnm_priv_t* vp, const char* label) {
+    const unsigned hash = label_hash(label);
+    unsigned slot = hash & vp->index_mask;
+    while(vp->index[slot]) {
+        vnm_db_file_t* dbf = vp->index[slot];
+        if(dbf->label_hash == hash && !strcmp(dbf->label, label))
+            return dbf;
+        slot = (slot + 1) & vp->index_mask;
     }
+    return NULL;
+}
+
+static vnm_db_file_t* dbf_new(const char* label, const char* path, const unsigned interval, const vnm_opts_t* opts) {
+    vnm_db_file_t* dbf = malloc(sizeof(vnm_db_file_t));
+
+    dbf->label = strdup(label);
+    dbf->label_hash = label_hash(label);
+    dbf->opts = *opts;
+    if(opts->cache_entries > __atomic_load_n(&cache_entries_max, __ATOMIC_RELAXED))
+        __atomic_store_n(&cache_entries_max, opts->cache_entries, __ATOMIC_RELAXED);
+    dbf->reload_check_interval = interval;
+    dbf->src = src_get(path, interval, opts);
+    return dbf;
+}
+
+static void dbf_destroy(vnm_db_file_t* dbf) {
+    src_put(dbf->src, dbf->reload_check_interval);
+    free(dbf->label);
+    free(dbf);
+}
+
+static void per_vcl_fini(void* vp_asvoid) {
+    vnm_priv_t* vp = vp_asvoid;
+
+    for(unsigned i = 0; i < vp->db_count; i++)
+        dbf_destroy(vp->dbs[i]);
 
+    free(vp->index);
     free(vp->dbs);
     free(vp);
 }
@@ -139,7 +433,13 @@ static void per_vcl_fini(void* vp_asvoid) {
  * Actual VMOD/VCL/VRT Hooks *
  *****************************/
 
-VCL_VOID vmod_init(VRT_CTX, struct vmod_priv *priv, VCL_STRING db_label, VCL_STRING json_path, VCL_INT reload_interval) {
+VCL_VOID vmod_init(VRT_CTX, struct vmod_priv *priv, VCL_STRING db_label, VCL_STRING json_path, VCL_INT reload_interval, VCL_STRING options) {
+    vnm_opts_t opts;
+    if(vnm_opts_parse(options, &opts)) {
+        VRT_fail(ctx, "vmod_netmapper: Bad options '%s' for database label '%s'", options, db_label);
+        return;
+    }
+
     vnm_priv_t* vp = priv->priv;
 
     if(!vp) {
@@ -149,82 +449,379 @@ VCL_VOID vmod_init(VRT_CTX, struct vmod_priv *priv, VCL_STRING db_label, VCL_STR
 
     const unsigned db_idx = vp->db_count++;
     vp->dbs = realloc(vp->dbs, vp->db_count * sizeof(vnm_db_file_t*));
-    vnm_db_file_t* dbf = vp->dbs[db_idx] = malloc(sizeof(vnm_db_file_t));
-
-    dbf->reload_check_interval = reload_interval;
-    dbf->fn = strdup(json_path);
-    dbf->label = strdup(db_label);
-    memset(&dbf->db_stat, 0, sizeof(struct stat));
-    dbf->db = vnm_db_parse(dbf->fn, &dbf->db_stat);
-    if(!dbf->db)
-        VSL(SLT_Error, 0, "vmod_netmapper: Failed initial load of JSON netmapper database %s (will keep trying periodically)", dbf->fn);
-
-    pthread_create(&dbf->updater, NULL, updater_start, dbf);
+    vp->dbs[db_idx] = dbf_new(db_label, json_path, reload_interval, &opts);
+    vp_index_rebuild(vp);
 }
 
 // Crazy hack to get per-thread rcu register/unregister, even though
 //   Varnish doesn't give us per-thread hooks for the workers
 //   (at least, not that I noticed...)
 // Note that it doesn't matter whether some threads are using two different
-//   databases from different VCLs with different JSON files.  RCU thread
+//   databases from different VCLs with different database files.  RCU thread
 //   registration is just a per-thread global thing.
+// The same destructor also frees the thread's result cache, if any.
 static pthread_key_t unreg_hack;
 static pthread_once_t unreg_hack_once = PTHREAD_ONCE_INIT;
-static void destruct_rcu(void* x) { pthread_setspecific(unreg_hack, NULL); rcu_unregister_thread(); }
+static __thread vnm_cache_t* thread_cache = NULL;
+static void destruct_rcu(void* x) {
+    pthread_setspecific(unreg_hack, NULL);
+    vnm_rcu_unregister_thread();
+    if(thread_cache) {
+        vnm_cache_destroy(thread_cache);
+        thread_cache = NULL;
+    }
+}
 static void make_unreg_hack(void) { pthread_key_create(&unreg_hack, destruct_rcu); }
 
-const char* vmod_map(const struct vrt_ctx *ctx, struct vmod_priv* priv, const char* db_label, const char* ip_string) {
-    assert(ctx); assert(priv); assert(priv->priv);
-	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+// The per-thread result cache is shared by all databases which use one
+//   (entries are tagged with the db generation), and sized for the
+//   largest cache=N seen so far, growing when a later init() wants more.
+static vnm_cache_t* get_thread_cache(void) {
+    const unsigned want = __atomic_load_n(&cache_entries_max, __ATOMIC_RELAXED);
+    if(!thread_cache || vnm_cache_entries(thread_cache) < want) {
+        if(thread_cache)
+            vnm_cache_destroy(thread_cache);
+        thread_cache = vnm_cache_new(want);
+    }
+    return thread_cache;
+}
 
-    if (!ip_string)
+// Most addresses map_list() maps in one call.  Past that, only the last
+//   ones are mapped, which in e.g. X-Forwarded-For are the ones added by
+//   the nearest proxies, rather than any a client padded it with.
+#define VNM_LIST_MAX 256U
+
+// The separators of map_list() addresses
+#define VNM_LIST_SEP ", \t"
+
+// The body of map_list(), with the database already dereferenced.  The
+//   results are joined with ", " in the order of the input addresses,
+//   with an empty string for each address that doesn't match.  The list
+//   is split in a copy on the workspace, rather than on the stack.
+static const char* vnm_map_list(const struct vrt_ctx *ctx, const vnm_db_t* dbptr, vnm_cache_t* cache, const char* ip_list) {
+    unsigned total = 0;
+    const char* p = ip_list + strspn(ip_list, VNM_LIST_SEP);
+    for(const char* q = p; *q; q += strspn(q, VNM_LIST_SEP)) {
+        q += strcspn(q, VNM_LIST_SEP);
+        total++;
+    }
+    if(!total)
+        return "";
+
+    unsigned skip = 0;
+    if(total > VNM_LIST_MAX) {
+        skip = total - VNM_LIST_MAX;
+        VSL(SLT_Error, 0, "vmod_netmapper: map_list() given %u addresses, mapping only the last %u", total, VNM_LIST_MAX);
+    }
+    const unsigned count = total - skip;
+    while(skip--) {
+        p += strcspn(p, VNM_LIST_SEP);
+        p += strspn(p, VNM_LIST_SEP);
+    }
+
+    const size_t list_len = strlen(p);
+    char* list = WS_Alloc(ctx->ws, list_len + 1U);
+    const char** addr_ptrs = WS_Alloc(ctx->ws, count * sizeof(*addr_ptrs));
+    const vnm_str_t** results = WS_Alloc(ctx->ws, count * sizeof(*results));
+    if(!list || !addr_ptrs || !results) {
+        VSL(SLT_Error, 0, "vmod_netmapper: no space for map_list() addresses!");
+        return NULL;
+    }
+
+    memcpy(list, p, list_len + 1U);
+    char* addr = list;
+    for(unsigned i = 0; i < count; i++) {
+        addr += strspn(addr, VNM_LIST_SEP);
+        addr_ptrs[i] = addr;
+        addr += strcspn(addr, VNM_LIST_SEP);
+        if(*addr)
+            *addr++ = '\0';
+    }
+
+    vnm_lookup_batch(dbptr, cache, count, addr_ptrs, results);
+
+    unsigned outlen = 1; // NUL
+    for(unsigned i = 0; i < count; i++)
+        outlen += (i ? 2 : 0) + (results[i]->data ? results[i]->len - 1 : 0);
+
+    char* rv = WS_Alloc(ctx->ws, outlen);
+    if(!rv) {
+        VSL(SLT_Error, 0, "vmod_netmapper: no space for string retval!");
         return NULL;
+    }
+
+    char* out = rv;
+    for(unsigned i = 0; i < count; i++) {
+        if(i) {
+            memcpy(out, ", ", 2);
+            out += 2;
+        }
+        if(results[i]->data) {
+            memcpy(out, results[i]->data, results[i]->len - 1);
+            out += results[i]->len - 1;
+        }
+    }
+    *out = '\0';
+
+    return rv;
+}
+
+// Databases with pin=task hold a reference to the database generation
+//   that a request task first looked up in, in the task's PRIV_TASK, so
+//   that the rest of the task can use it without any RCU work, and map()
+//   can return strings straight out of it.  The references are dropped
+//   at the end of the task, and the database freed then if the updater
+//   has replaced it in the meantime.
+#define VNM_TASK_PINS 8U
+
+typedef struct {
+    unsigned count;
+    const vnm_db_file_t* dbf[VNM_TASK_PINS];
+    vnm_db_t* db[VNM_TASK_PINS];
+} vnm_task_pins_t;
+
+static void task_pins_fini(void* pins_asvoid) {
+    vnm_task_pins_t* pins = pins_asvoid;
+    for(unsigned i = 0; i < pins->count; i++)
+        vnm_db_unref(pins->db[i]);
+    free(pins);
+}
+
+// Returns the database pinned for this task, pinning the current one if
+//   necessary, or NULL if there's none loaded or no room to pin another
+//   (the caller falls back to the normal RCU path then).
+static const vnm_db_t* vnm_task_pin(struct vmod_priv* task, vnm_db_file_t* dbf) {
+    vnm_task_pins_t* pins = task->priv;
+    if(!pins) {
+        task->priv = pins = calloc(1, sizeof(vnm_task_pins_t));
+        task->free = task_pins_fini;
+    }
+
+    for(unsigned i = 0; i < pins->count; i++)
+        if(pins->dbf[i] == dbf)
+            return pins->db[i];
+
+    if(pins->count == VNM_TASK_PINS)
+        return NULL;
+
+    // take the reference inside the critical section, before the updater
+    //   could possibly drop its own
+    const unsigned rcu_token = vnm_rcu_read_lock(&dbf->src->rcu);
+    vnm_db_t* db = vnm_rcu_dereference(dbf->src->db);
+    if(db)
+        vnm_db_ref(db);
+    vnm_rcu_read_unlock(&dbf->src->rcu, rcu_token);
+
+    if(db) {
+        pins->dbf[pins->count] = dbf;
+        pins->db[pins->count] = db;
+        pins->count++;
+    }
+
+    return db;
+}
+
+// The lookup itself, for any of map(), map_ip(), map_list(), once the
+//   database is in hand.  With "pinned", the database outlives the
+//   task, and plain results can point straight into it.
+static const char* vnm_map_db(const struct vrt_ctx *ctx, const vnm_db_file_t* dbf, const vnm_db_t* dbptr, const bool pinned, const char* ip_string, const struct sockaddr* sa, const char* ip_list) {
+    vnm_cache_t* cache = dbf->opts.cache_entries ? get_thread_cache() : NULL;
+    if(ip_list)
+        return vnm_map_list(ctx, dbptr, cache, ip_list);
+
+    const vnm_str_t* str = ip_string
+        ? vnm_lookup(dbptr, cache, ip_string)
+        : vnm_lookup_sa(dbptr, cache, sa);
+    if(!str)
+        return NULL;
+    return pinned ? str->data : vnm_str_to_vcl(ctx, str);
+}
+
+// Shared by the label functions and the db object methods: exactly one of
+//   ip_string, sa, or ip_list is set
+static const char* vnm_map_dbf(const struct vrt_ctx *ctx, struct vmod_priv* task, vnm_db_file_t* dbf, const char* ip_string, const struct sockaddr* sa, const char* ip_list) {
+    assert(ctx); assert(task); assert(dbf);
+    assert(!!ip_string + !!sa + !!ip_list == 1);
 
     // The rest of the rcu register/unregister hack
     static __thread bool rcu_registered = false;
     if(!rcu_registered) {
         pthread_once(&unreg_hack_once, make_unreg_hack);
         pthread_setspecific(unreg_hack, (void*)1);
-        rcu_register_thread();
+        vnm_rcu_register_thread();
         rcu_registered = true;
     }
 
-    // static database index, no thread concerns during runtime...
-    const vnm_priv_t* vp = priv->priv;
-    const vnm_db_file_t* dbf = NULL;
-    for(unsigned i = 0; i < vp->db_count; i++) {
-        if(!strcmp(db_label, vp->dbs[i]->label)) {
-            dbf = vp->dbs[i];
-            break;
-        }
-    }
-
     const char* rv = NULL;
 
-    if(!dbf) {
-        VSL(SLT_Error, 0, "vmod_netmapper: JSON database label '%s' is not configured!", db_label);
+    const vnm_db_t* pinned = dbf->opts.pin_task ? vnm_task_pin(task, dbf) : NULL;
+
+    if(pinned) {
+        rv = vnm_map_db(ctx, dbf, pinned, true, ip_string, sa, ip_list);
     }
     else {
         // normal rcu reader stuff
-        rcu_thread_online();
-        rcu_read_lock();
+        const unsigned rcu_token = vnm_rcu_read_lock(&dbf->src->rcu);
 
-        const vnm_db_t* dbptr = rcu_dereference(dbf->db);
+        const vnm_db_t* dbptr = vnm_rcu_dereference(dbf->src->db);
         if(dbptr) {
             // search net database.  if match, convert
             //  string to a vcl string and return it...
-            const vnm_str_t* str = vnm_lookup(dbptr, ip_string);
-            if(str)
-                rv = vnm_str_to_vcl(ctx, str);
+            rv = vnm_map_db(ctx, dbf, dbptr, false, ip_string, sa, ip_list);
         }
         else {
-            VSL(SLT_Error, 0, "vmod_netmapper: JSON database label '%s' was never succesfully loaded!", db_label);
+            VSL(SLT_Error, 0, "vmod_netmapper: database '%s' was never succesfully loaded!", dbf->label);
         }
 
         // normal rcu reader stuff
-        rcu_read_unlock();
-        rcu_thread_offline();
+        vnm_rcu_read_unlock(&dbf->src->rcu, rcu_token);
     }
 
     return rv;
 }
+
+// map(), map_ip() and map_list(), by label
+static const char* vnm_map_common(const struct vrt_ctx *ctx, struct vmod_priv* priv, struct vmod_priv* task, const char* db_label, const char* ip_string, const struct sockaddr* sa, const char* ip_list) {
+    assert(ctx); assert(priv); assert(priv->priv); assert(task);
+
+    // static database index, no thread concerns during runtime...
+    vnm_db_file_t* dbf = db_label ? vp_find(priv->priv, db_label) : NULL;
+    if(!dbf) {
+        VSL(SLT_Error, 0, "vmod_netmapper: database label '%s' is not configured!", db_label ? db_label : "");
+        return NULL;
+    }
+
+    return vnm_map_dbf(ctx, task, dbf, ip_string, sa, ip_list);
+}
+
+const char* vmod_map(const struct vrt_ctx *ctx, struct vmod_priv* priv, struct vmod_priv* task, const char* db_label, const char* ip_string) {
+    assert(ctx); assert(priv); assert(priv->priv);
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+    if (!ip_string)
+        return NULL;
+
+    return vnm_map_common(ctx, priv, task, db_label, ip_string, NULL, NULL);
+}
+
+// Takes the VCL IP type directly, avoiding the string formatting by varnish
+//   and the parse back to binary in vnm_lookup()
+VCL_STRING vmod_map_ip(VRT_CTX, struct vmod_priv* priv, struct vmod_priv* task, VCL_STRING db_label, VCL_IP ip) {
+    assert(ctx); assert(priv); assert(priv->priv);
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+    if(!ip)
+        return NULL;
+
+    socklen_t sl;
+    const struct sockaddr* sa = VSA_Get_Sockaddr(ip, &sl);
+    if(!sa)
+        return NULL;
+
+    return vnm_map_common(ctx, priv, task, db_label, NULL, sa, NULL);
+}
+
+// Maps a comma and/or space separated list of addresses in one go, see
+//   vnm_map_list() and vnm_lookup_batch()
+VCL_STRING vmod_map_list(VRT_CTX, struct vmod_priv* priv, struct vmod_priv* task, VCL_STRING db_label, VCL_STRING ip_list) {
+    assert(ctx); assert(priv); assert(priv->priv);
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+    if(!ip_list)
+        return NULL;
+
+    return vnm_map_common(ctx, priv, task, db_label, NULL, NULL, ip_list);
+}
+
+// Process-wide result cache counters, see vnm_cache_totals()
+VCL_STRING vmod_cache_stats(VRT_CTX) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+    uint64_t hits, misses;
+    vnm_cache_totals(&hits, &misses);
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "hits=%" PRIu64 " misses=%" PRIu64, hits, misses);
+    return WS_Copy(ctx->ws, buf, -1);
+}
+
+// Process-wide deferred reclamation counters, see vnm_rcu_stats()
+VCL_STRING vmod_rcu_stats(VRT_CTX) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+    vnm_rcu_stats_t st;
+    vnm_rcu_stats(&st);
+
+    char buf[192];
+    snprintf(buf, sizeof(buf), "pending=%" PRIu64 " retired=%" PRIu64 " grace_periods=%" PRIu64
+        " grace_us_last=%" PRIu64 " grace_us_max=%" PRIu64 " grace_us_avg=%" PRIu64,
+        st.pending, st.retired, st.grace_periods, st.grace_us_last, st.grace_us_max,
+        st.grace_periods ? st.grace_us_total / st.grace_periods : 0);
+    return WS_Copy(ctx->ws, buf, -1);
+}
+
+// The db object: same database machinery as init(), bound to the object
+//   at VCL load rather than looked up by label on every call
+
+VCL_VOID vmod_db__init(VRT_CTX, struct vmod_netmapper_db** dbp, const char* vcl_name, VCL_STRING json_path, VCL_INT reload_interval, VCL_STRING options) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    AN(dbp); AZ(*dbp); AN(vcl_name);
+
+    vnm_opts_t opts;
+    if(vnm_opts_parse(options, &opts)) {
+        VRT_fail(ctx, "vmod_netmapper: Bad options '%s' for database object '%s'", options, vcl_name);
+        return;
+    }
+
+    struct vmod_netmapper_db* db;
+    ALLOC_OBJ(db, VMOD_NETMAPPER_DB_MAGIC);
+    AN(db);
+    db->dbf = dbf_new(vcl_name, json_path, reload_interval, &opts);
+    *dbp = db;
+}
+
+VCL_VOID vmod_db__fini(struct vmod_netmapper_db** dbp) {
+    AN(dbp);
+    if(!*dbp)
+        return;
+    struct vmod_netmapper_db* db = *dbp;
+    *dbp = NULL;
+    CHECK_OBJ(db, VMOD_NETMAPPER_DB_MAGIC);
+    dbf_destroy(db->dbf);
+    FREE_OBJ(db);
+}
+
+VCL_STRING vmod_db_map(VRT_CTX, struct vmod_netmapper_db* db, struct vmod_priv* task, VCL_STRING ip_string) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(db, VMOD_NETMAPPER_DB_MAGIC);
+
+    if(!ip_string)
+        return NULL;
+
+    return vnm_map_dbf(ctx, task, db->dbf, ip_string, NULL, NULL);
+}
+
+VCL_STRING vmod_db_map_ip(VRT_CTX, struct vmod_netmapper_db* db, struct vmod_priv* task, VCL_IP ip) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(db, VMOD_NETMAPPER_DB_MAGIC);
+
+    if(!ip)
+        return NULL;
+
+    socklen_t sl;
+    const struct sockaddr* sa = VSA_Get_Sockaddr(ip, &sl);
+    if(!sa)
+        return NULL;
+
+    return vnm_map_dbf(ctx, task, db->dbf, NULL, sa, NULL);
+}
+
+VCL_STRING vmod_db_map_list(VRT_CTX, struct vmod_netmapper_db* db, struct vmod_priv* task, VCL_STRING ip_list) {
+    CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+    CHECK_OBJ_NOTNULL(db, VMOD_NETMAPPER_DB_MAGIC);
+
+    if(!ip_list)
+        return NULL;
+
+    return vnm_map_dbf(ctx, task, db->dbf, NULL, NULL, ip_list);
+}
@@ -17,13 +17,7 @@
  *
  */
 
-#ifdef NO_VARNISH
-#define ERR(fmt,...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
-#else
-#include "cache/cache.h"
-#define ERR(fmt,...) VSL(SLT_Error, 0, "vmod_netmapper: " fmt, ##__VA_ARGS__)
-#endif
-
+#include "vnm_log.h"
 #include "vnm.h"
 
 #include <assert.h>
@@ -34,111 +28,192 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 
-#include <jansson.h>
-
 #include "vnm_strdb.h"
+#include "vnm_addr.h"
+#include "vnm_bin.h"
+#include "vnm_delta.h"
+#include "vnm_json.h"
+#include "vnm_mmdb.h"
+#include "vnm_text.h"
+#include "vnm_engine.h"
 #include "ntree.h"
+#include "ndir4.h"
 #include "nlist.h"
 
 struct _vnm_db_struct {
-    ntree_t* tree;
+    const vnm_engine_t* engine;
+    void* einst; // engine instance
+    ndir4_t* v4dir; // optional, NULL if not configured
     vnm_strdb_t* strdb;
+    void* map; // compiled file mapping, if that's where it came from
+    size_t map_len;
+    vnm_delta_t* delta; // NULL unless delta=on
+    uint64_t generation;
+    unsigned refs;
 };
 
+// last generation handed out, shared by all databases
+static uint64_t vnm_generation = 0;
+
+// Largest accepted cache=N
+#define VNM_CACHE_MAX (1U << 20)
+
+// Largest accepted build_threads=N
+#define VNM_BUILD_THREADS_MAX 256U
+
+bool vnm_opts_parse(const char* str, vnm_opts_t* opts) {
+    assert(opts);
+
+    memset(opts, 0, sizeof(vnm_opts_t));
+
+    if(!str || !*str)
+        return false;
+
+    // split "k1=v1,k2=v2" in a stack copy
+    const unsigned inlen = strlen(str);
+    char buf[inlen + 1];
+    memcpy(buf, str, inlen + 1);
+
+    char* saveptr = NULL;
+    for(char* opt = strtok_r(buf, ",", &saveptr); opt; opt = strtok_r(NULL, ",", &saveptr)) {
+        char* val = strchr(opt, '=');
+        if(val)
+            *val++ = '\0';
+
+        if(!strcmp(opt, "engine")) {
+            if(val && !strcmp(val, "tree"))
+                opts->engine = VNM_ENGINE_TREE;
+            else if(val && !strcmp(val, "poptrie"))
+                opts->engine = VNM_ENGINE_POPTRIE;
+            else if(val && !strcmp(val, "range"))
+                opts->engine = VNM_ENGINE_RANGE;
+            else if(val && !strcmp(val, "auto"))
+                opts->engine = VNM_ENGINE_AUTO;
+            else {
+                ERR("Option engine must be one of tree, poptrie, range, or auto");
+                return true;
+            }
+        }
+        else if(!strcmp(opt, "v4table")) {
+            if(val && !strcmp(val, "16"))
+                opts->v4table_bits = 16;
+            else if(val && !strcmp(val, "24"))
+                opts->v4table_bits = 24;
+            else if(val && !strcmp(val, "off"))
+                opts->v4table_bits = 0;
+            else {
+                ERR("Option v4table must be one of 16, 24, or off");
+                return true;
+            }
+        }
+        else if(!strcmp(opt, "cache")) {
+            char* endptr = NULL;
+            const unsigned long entries = val ? strtoul(val, &endptr, 10) : 0;
+            if(!val || !*val || *endptr || entries > VNM_CACHE_MAX) {
+                ERR("Option cache must be an entry count from 0 to %u", VNM_CACHE_MAX);
+                return true;
+            }
+            opts->cache_entries = entries;
+        }
+        else if(!strcmp(opt, "pin")) {
+            if(val && !strcmp(val, "task"))
+                opts->pin_task = true;
+            else if(val && !strcmp(val, "off"))
+                opts->pin_task = false;
+            else {
+                ERR("Option pin must be one of task or off");
+                return true;
+            }
+        }
+        else if(!strcmp(opt, "build_threads")) {
+            if(val && !strcmp(val, "auto")) {
+                const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                opts->build_threads = ncpu < 1 ? 1U
+                    : ncpu > (long)VNM_BUILD_THREADS_MAX ? VNM_BUILD_THREADS_MAX
+                    : (unsigned)ncpu;
+            }
+            else {
+                char* endptr = NULL;
+                const unsigned long threads = val ? strtoul(val, &endptr, 10) : 0;
+                if(!val || !*val || *endptr || !threads || threads > VNM_BUILD_THREADS_MAX) {
+                    ERR("Option build_threads must be auto or a thread count from 1 to %u", VNM_BUILD_THREADS_MAX);
+                    return true;
+                }
+                opts->build_threads = threads;
+            }
+        }
+        else if(!strcmp(opt, "delta")) {
+            if(val && !strcmp(val, "on"))
+                opts->delta = true;
+            else if(val && !strcmp(val, "off"))
+                opts->delta = false;
+            else {
+                ERR("Option delta must be one of on or off");
+                return true;
+            }
+        }
+        else if(!strcmp(opt, "mmdb_key")) {
+            const size_t klen = val ? strlen(val) : 0;
+            if(!klen || klen >= VNM_MMDB_KEY_MAX || val[0] == '.' || val[klen - 1] == '.' || strstr(val, "..")) {
+                ERR("Option mmdb_key must be a dot-separated field path of up to %u characters", VNM_MMDB_KEY_MAX - 1U);
+                return true;
+            }
+            memcpy(opts->mmdb_key, val, klen + 1);
+        }
+        else {
+            ERR("Unknown database option '%s'", opt);
+            return true;
+        }
+    }
+
+    // an update costs about as much as the networks it changes, which a
+    //   v4table rebuild (up to 2^24 entries per copy) would swamp
+    if(opts->delta && (opts->engine != VNM_ENGINE_TREE || opts->v4table_bits)) {
+        ERR("Option delta=on only works with engine=tree and v4table=off");
+        return true;
+    }
+
+    return false;
+}
+
 void vnm_db_destruct(vnm_db_t* d) {
-    ntree_destroy(d->tree);
+    d->engine->destroy(d->einst);
+    if(d->v4dir)
+        ndir4_destroy(d->v4dir);
     vnm_strdb_destroy(d->strdb);
+    if(d->map)
+        vnm_bin_unmap(d->map, d->map_len);
+    if(d->delta)
+        vnm_delta_destroy(d->delta);
     free(d);
 }
 
-static bool v6_subnet_of(const uint8_t* check, const unsigned check_mask, const uint8_t* v4, const unsigned v4_mask) {
-    assert(check); assert(v4);
-    assert(!(v4_mask & 7)); // all v4_mask are whole byte masks
-
-    bool rv = false;
-
-    if(check_mask >= v4_mask)
-        rv = !memcmp(check, v4, (v4_mask >> 3));
-
-    return rv;
+void vnm_db_ref(vnm_db_t* d) {
+    assert(d);
+    __atomic_add_fetch(&d->refs, 1, __ATOMIC_RELAXED);
 }
 
-static bool check_v4_issues(const uint8_t* ipv6, const unsigned mask) {
-    assert(ipv6); assert(mask < 129);
-
-    return (
-          v6_subnet_of(ipv6, mask, start_v4mapped, 96)
-       || v6_subnet_of(ipv6, mask, start_siit, 96)
-       || v6_subnet_of(ipv6, mask, start_teredo, 32)
-       || v6_subnet_of(ipv6, mask, start_6to4, 16)
-    );
+void vnm_db_unref(vnm_db_t* d) {
+    assert(d);
+    if(!__atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL))
+        vnm_db_destruct(d);
 }
 
 static bool append_string_to_nlist(const char* fn, const char* key, nlist_t* nl, const char* addr_mask, const unsigned stridx) {
-
-    // convert "192.0.2.0/24\0" -> "192.0.2.0\0" + "24\0" in stack
-    const unsigned inlen = strlen(addr_mask);
-    char net_str[inlen + 1];
-    memcpy(net_str, addr_mask, inlen + 1);
-    char* mask_str = strchr(net_str, '/');
-    if(mask_str)
-        *mask_str++ = '\0';
-
-    // translate text address + mask to sockaddr stuff (putting mask in port field)
-    struct addrinfo* ainfo = NULL;
-    const struct addrinfo hints = {
-        .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
-        .ai_family = AF_UNSPEC,
-        .ai_socktype = 0,
-        .ai_protocol = 0,
-        .ai_addrlen = 0,
-        .ai_addr = NULL,
-        .ai_canonname = NULL,
-        .ai_next = NULL
-    };
-    const int addr_err = getaddrinfo(net_str, mask_str, &hints, &ainfo);
-    if(addr_err) {
-        ERR("JSON database '%s', key '%s': '%s' does not parse as addr/mask: %s", fn, key, net_str, gai_strerror(addr_err));
-        return true;
-    }
-
-    // Copy data to simple ipv6 + mask values, check for errors
- 
     unsigned mask;
     uint8_t ipv6[16];
 
-    if(ainfo->ai_family == AF_INET6) {
-        const struct sockaddr_in6* sin6 = (struct sockaddr_in6*)ainfo->ai_addr;
-        mask = mask_str ? ntohs(sin6->sin6_port) : 128;
-        memcpy(ipv6, sin6->sin6_addr.s6_addr, 16);
-        if(check_v4_issues(ipv6, mask)) {
-            ERR("JSON database '%s', key '%s': '%s' covers illegal IPv4-like space", fn, key, addr_mask);
-            freeaddrinfo(ainfo);
-            return true;
-        }
-    }
-    else {
-        assert(ainfo->ai_family == AF_INET);
-        const struct sockaddr_in* sin = (struct sockaddr_in*)ainfo->ai_addr;
-        mask = mask_str ? ntohs(sin->sin_port) + 96 : 128;
-        memset(ipv6, 0, 16);
-        memcpy(&ipv6[12], &sin->sin_addr.s_addr, 4);
-    }
-
-    if(mask > 128) {
-        ERR("JSON database '%s', key '%s': '%s' has illegal netmask", fn, key, addr_mask);
-        freeaddrinfo(ainfo);
+    const char* why = vnm_net_parse(addr_mask, ipv6, &mask);
+    if(why) {
+        ERR("JSON database '%s', key '%s': '%s' %s", fn, key, addr_mask, why);
         return true;
     }
 
-    freeaddrinfo(ainfo);
-
     // actually stick data in the nlist using existing call
     if(nlist_append(nl, ipv6, mask, stridx))
         ERR("JSON database '%s', key '%s': '%s' has bits beyond the network mask, which were auto-cleared!", fn, key, addr_mask);
@@ -146,99 +221,164 @@ static bool append_string_to_nlist(const char* fn, const char* key, nlist_t* nl,
     return false;
 }
 
-vnm_db_t* vnm_db_parse(const char* fn, struct stat* db_stat) {
-    assert(fn);
+// State for the vnm_json_stream() callbacks in vnm_list_load()
+typedef struct {
+    const char* fn;
+    vnm_strdb_t* strdb;
+    nlist_t* nl;
+    unsigned stridx; // of the current key
+} vnm_json_load_t;
 
-    struct stat db_stat_precheck;
-    if(stat(fn, &db_stat_precheck)) {
-        ERR("Failed to stat() JSON database %s: %u", fn, errno);
+static bool vnm_json_load_key(void* data, const char* key) {
+    vnm_json_load_t* jl = data;
+    jl->stridx = vnm_strdb_add(jl->strdb, key);
+    return false;
+}
+
+static bool vnm_json_load_net(void* data, const char* key, const char* net) {
+    vnm_json_load_t* jl = data;
+    return append_string_to_nlist(jl->fn, key, jl->nl, net, jl->stridx);
+}
+
+// Loads a JSON, text or MMDB database ("mmdb_key" non-NULL) into a new
+//   tree, adding its keys to strdb.  Each file goes straight into the
+//   nlist, so there's never a parsed copy of the whole document in
+//   memory.  With "base_p", the list is left unmerged and handed back
+//   there, for vnm_delta_new().  Returns NULL on error (logged).
+static ntree_t* vnm_list_load(const char* fn, const char* mmdb_key, vnm_strdb_t* strdb, const unsigned threads, nlist_t** base_p) {
+    vnm_json_load_t jl = {
+        .fn = fn,
+        .strdb = strdb,
+        .nl = nlist_new(),
+        .stridx = 0,
+    };
+
+    bool failed;
+    if(mmdb_key)
+        failed = vnm_mmdb_load(fn, mmdb_key, strdb, jl.nl);
+    else if(vnm_text_detect(fn))
+        failed = vnm_text_load(fn, strdb, jl.nl);
+    else
+        failed = vnm_json_stream(fn, vnm_json_load_key, vnm_json_load_net, &jl);
+    if(failed) {
+        nlist_destroy(jl.nl);
         return NULL;
     }
 
-    json_error_t errobj;
-    json_t* toplevel = json_load_file(fn, 0, &errobj);
+    // add undefined areas for the translated v4 subspaces and optimize the list
+    nlist_append(jl.nl, start_v4mapped, 96, NN_UNDEF);
+    nlist_append(jl.nl, start_siit, 96, NN_UNDEF);
+    nlist_append(jl.nl, start_6to4, 16, NN_UNDEF);
+    nlist_append(jl.nl, start_teredo, 32, NN_UNDEF);
+    if(base_p)
+        nlist_finish_unmerged(jl.nl, false);
+    else
+        nlist_finish(jl.nl);
+
+    ntree_t* tree = nlist_xlate_tree(jl.nl, threads);
+    if(base_p)
+        *base_p = jl.nl;
+    else
+        nlist_destroy(jl.nl);
+    return tree;
+}
 
-    if(!toplevel) {
-        ERR("Failed to load JSON database %s: %s", fn, errobj.text);
+vnm_db_t* vnm_db_parse(const char* fn, struct stat* db_stat, const vnm_opts_t* opts) {
+    assert(fn);
+
+    struct stat db_stat_precheck;
+    if(stat(fn, &db_stat_precheck)) {
+        ERR("Failed to stat() database %s: %u", fn, errno);
         return NULL;
     }
 
-    if(!json_is_object(toplevel) && !(json_is_array(toplevel) && !json_array_size(toplevel))) {
-        ERR("JSON database %s top-level is not an object or empty array!", fn);
-        json_decref(toplevel);
-        return NULL;
+    vnm_db_t* d = malloc(sizeof(vnm_db_t));
+    d->engine = NULL;
+    d->einst = NULL;
+    d->v4dir = NULL;
+    d->strdb = NULL;
+    d->map = NULL;
+    d->map_len = 0;
+    d->delta = NULL;
+
+    // compiled files are used in place, the others are loaded into a new tree
+    const bool delta = opts && opts->delta;
+    ntree_t* tree = NULL;
+    nlist_t* base = NULL;
+    if(vnm_bin_detect(fn)) {
+        if(delta) {
+            ERR("Database %s is compiled, and delta=on only works with JSON, text and MMDB databases", fn);
+            free(d);
+            return NULL;
+        }
+        if(vnm_bin_load(fn, &d->map, &d->map_len, &tree, &d->strdb)) {
+            free(d);
+            return NULL;
+        }
+    }
+    else {
+        const char* mmdb_key = vnm_mmdb_detect(fn) ? (opts ? opts->mmdb_key : "") : NULL;
+        d->strdb = vnm_strdb_new();
+        tree = vnm_list_load(fn, mmdb_key, d->strdb, opts ? opts->build_threads : 1U, delta ? &base : NULL);
+        if(!tree) {
+            vnm_strdb_destroy(d->strdb);
+            free(d);
+            return NULL;
+        }
+        // the delta file may still add keys
+        if(!delta)
+            vnm_strdb_finish(d->strdb);
     }
 
+    bool failed = false;
     struct stat db_stat_postcheck;
     if(stat(fn, &db_stat_postcheck)) {
-        ERR("Failed to stat() JSON database %s: %u", fn, errno);
-        json_decref(toplevel);
-        return NULL;
+        ERR("Failed to stat() database %s: %u", fn, errno);
+        failed = true;
+    }
+    else if(   db_stat_postcheck.st_mtime != db_stat_precheck.st_mtime
+            || db_stat_postcheck.st_ctime != db_stat_precheck.st_ctime
+            || db_stat_postcheck.st_ino   != db_stat_precheck.st_ino
+            || db_stat_postcheck.st_dev   != db_stat_precheck.st_dev) {
+        ERR("Database %s changed while reading!", fn);
+        failed = true;
     }
 
-    if(    db_stat_postcheck.st_mtime != db_stat_precheck.st_mtime
-        || db_stat_postcheck.st_ctime != db_stat_precheck.st_ctime
-        || db_stat_postcheck.st_ino   != db_stat_precheck.st_ino
-        || db_stat_postcheck.st_dev   != db_stat_precheck.st_dev) {
-        ERR("JSON database %s changed while reading!", fn);
-        json_decref(toplevel);
+    if(failed) {
+        ntree_destroy(tree);
+        vnm_strdb_destroy(d->strdb);
+        if(base)
+            nlist_destroy(base);
+        if(d->map)
+            vnm_bin_unmap(d->map, d->map_len);
+        free(d);
         return NULL;
     }
 
-    nlist_t* templist = nlist_new();
-    vnm_db_t* d = malloc(sizeof(vnm_db_t));
-    d->tree = NULL;
-    d->strdb = vnm_strdb_new();
-
-    if(json_is_object(toplevel)) {
-        // iterate the keys...
-        const char* key;
-        json_t* val;
-        void *iter = json_object_iter(toplevel);
-        while(iter) {
-            key = json_object_iter_key(iter);
-            val = json_object_iter_value(iter);
-            if(!json_is_array(val)) {
-                ERR("JSON database %s: value for key '%s' should be an array!", fn, key);
-                nlist_destroy(templist);
-                vnm_strdb_destroy(d->strdb);
-                free(d);
-                json_decref(toplevel);
-                return NULL;
-            }
-
-            const unsigned stridx = vnm_strdb_add(d->strdb, key);
-            const unsigned nnets = json_array_size(val);
-            for(unsigned i = 0; i < nnets; i++) {
-                const json_t* net = json_array_get(val, i);
-                const bool net_isstr = json_is_string(net);
-                if(!net_isstr)
-                    ERR("JSON database %s: array member %u for key '%s' should be an address string!", fn, i, key);
-                if(!net_isstr || append_string_to_nlist(fn, key, templist, json_string_value(net), stridx)) {
-                    nlist_destroy(templist);
-                    vnm_strdb_destroy(d->strdb);
-                    free(d);
-                    json_decref(toplevel);
-                    return NULL;
-                }
-            }
-            iter = json_object_iter_next(toplevel, iter);
+    // the delta file, on top, which takes over the tree and strdb
+    if(delta) {
+        d->delta = vnm_delta_new(fn, base, &tree, &d->strdb);
+        if(!d->delta) {
+            free(d);
+            return NULL;
         }
     }
 
-    // add undefined areas for the translated v4 subspaces and optimize the list
-    nlist_append(templist, start_v4mapped, 96, NN_UNDEF);
-    nlist_append(templist, start_siit, 96, NN_UNDEF);
-    nlist_append(templist, start_6to4, 16, NN_UNDEF);
-    nlist_append(templist, start_teredo, 32, NN_UNDEF);
-    nlist_finish(templist);
-
-    // translate to tree for lookup
-    d->tree = nlist_xlate_tree(templist);
+    // build the lookup structures from the tree
+    if(opts && opts->v4table_bits)
+        d->v4dir = ndir4_new(tree, opts->v4table_bits);
+    if(opts && opts->engine == VNM_ENGINE_AUTO) {
+        d->engine = vnm_engine_auto(tree, &d->einst);
+    }
+    else {
+        d->engine = vnm_engine_get(opts ? opts->engine : VNM_ENGINE_TREE);
+        d->einst = d->engine->build(tree);
+    }
+    if(d->engine != &vnm_engine_tree)
+        ntree_destroy(tree);
 
-    // free up temporary stuff
-    nlist_destroy(templist);
-    json_decref(toplevel);
+    d->generation = __atomic_add_fetch(&vnm_generation, 1, __ATOMIC_RELAXED);
+    d->refs = 1;
 
     // copy out stat data for future checks
     if(db_stat)
@@ -247,33 +387,207 @@ vnm_db_t* vnm_db_parse(const char* fn, struct stat* db_stat) {
     return d;
 }
 
-const vnm_str_t* vnm_lookup(const vnm_db_t* d, const char* ip_string) {
-    assert(d); assert(d->tree); assert(d->strdb); assert(ip_string);
+vnm_db_t* vnm_db_update(vnm_db_t* d, bool* reload_p) {
+    assert(d); assert(reload_p);
+
+    *reload_p = false;
+    if(!d->delta)
+        return NULL;
+
+    ntree_t* tree;
+    vnm_strdb_t* strdb;
+    vnm_delta_t* delta = vnm_delta_update(d->delta, &tree, &strdb, reload_p);
+    if(!delta)
+        return NULL;
+
+    vnm_db_t* nd = malloc(sizeof(vnm_db_t));
+    nd->engine = &vnm_engine_tree;
+    nd->einst = nd->engine->build(tree);
+    nd->v4dir = NULL;
+    nd->strdb = strdb;
+    nd->map = NULL;
+    nd->map_len = 0;
+    nd->delta = delta;
+    nd->generation = __atomic_add_fetch(&vnm_generation, 1, __ATOMIC_RELAXED);
+    nd->refs = 1;
+    return nd;
+}
+
+bool vnm_db_compile(const char* in_fn, const char* out_fn, const vnm_opts_t* opts) {
+    assert(in_fn); assert(out_fn);
+
+    // default options, for the plain tree engine
+    vnm_opts_t copts;
+    vnm_opts_parse(NULL, &copts);
+    if(opts) {
+        copts.build_threads = opts->build_threads;
+        memcpy(copts.mmdb_key, opts->mmdb_key, sizeof(copts.mmdb_key));
+    }
+    vnm_db_t* d = vnm_db_parse(in_fn, NULL, &copts);
+    if(!d)
+        return true;
+    assert(d->engine == &vnm_engine_tree);
+
+    const bool rv = vnm_bin_write(out_fn, d->einst, d->strdb);
+    vnm_db_destruct(d);
+    return rv;
+}
+
+static unsigned vnm_lookup_v4(const vnm_db_t* d, const uint32_t ipv4) {
+    unsigned rv;
+    if(d->v4dir)
+        rv = ndir4_lookup(d->v4dir, ipv4);
+    else
+        rv = d->engine->lookup_v4(d->einst, ipv4);
+    return rv;
+}
+
+static unsigned vnm_lookup_v6(const vnm_db_t* d, const uint8_t* ipv6) {
+    unsigned rv;
+    uint32_t ipv4;
+    if(d->v4dir && v6_v4fixup(ipv6, &ipv4))
+        rv = ndir4_lookup(d->v4dir, ipv4);
+    else
+        rv = d->engine->lookup_v6(d->einst, ipv6);
+    return rv;
+}
+
+// The same through the optional result cache.  IPv4 is keyed as
+//   ::ffff:a.b.c.d, which the v6 path maps to the same result anyway.
+//   A v4table lookup is cheaper than the cache's, so IPv4 and the v4-like
+//   spaces skip the cache when there is one.
+static unsigned vnm_lookup_v4_cached(const vnm_db_t* d, vnm_cache_t* cache, const uint32_t ipv4) {
+    if(!cache || d->v4dir)
+        return vnm_lookup_v4(d, ipv4);
+
+    uint8_t key[16];
+    const uint32_t ipv4_nbo = htonl(ipv4);
+    memcpy(key, start_v4mapped, 12);
+    memcpy(&key[12], &ipv4_nbo, 4);
+
+    unsigned rv;
+    if(!vnm_cache_get(cache, d->generation, key, &rv)) {
+        rv = vnm_lookup_v4(d, ipv4);
+        vnm_cache_put(cache, d->generation, key, rv);
+    }
+    return rv;
+}
+
+static unsigned vnm_lookup_v6_cached(const vnm_db_t* d, vnm_cache_t* cache, const uint8_t* ipv6) {
+    uint32_t ipv4;
+    if(d->v4dir && v6_v4fixup(ipv6, &ipv4))
+        return ndir4_lookup(d->v4dir, ipv4);
+    if(!cache)
+        return vnm_lookup_v6(d, ipv6);
+
+    unsigned rv;
+    if(!vnm_cache_get(cache, d->generation, ipv6, &rv)) {
+        rv = vnm_lookup_v6(d, ipv6);
+        vnm_cache_put(cache, d->generation, ipv6, rv);
+    }
+    return rv;
+}
+
+uint64_t vnm_db_generation(const vnm_db_t* d) {
+    assert(d);
+    return d->generation;
+}
+
+const vnm_str_t* vnm_lookup(const vnm_db_t* d, vnm_cache_t* cache, const char* ip_string) {
+    assert(d); assert(d->einst); assert(d->strdb); assert(ip_string);
 
     unsigned stridx = 0; // default, no-match
 
-    // translate text address -> sockaddr
-    struct addrinfo* ainfo = NULL;
-    const struct addrinfo hints = {
-        .ai_flags = AI_NUMERICHOST,
-        .ai_family = AF_UNSPEC,
-        .ai_socktype = 0,
-        .ai_protocol = 0,
-        .ai_addrlen = 0,
-        .ai_addr = NULL,
-        .ai_canonname = NULL,
-        .ai_next = NULL
-    };
-    const int addr_err = getaddrinfo(ip_string, NULL, &hints, &ainfo);
-    if(addr_err) {
-        ERR("Client IP '%s' does not parse: %s", ip_string, gai_strerror(addr_err));
+    // translate text address -> raw bytes on the stack
+    uint8_t addr[16];
+    const int family = vnm_addr_parse(ip_string, addr);
+    if(family == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, addr, 4);
+        stridx = vnm_lookup_v4_cached(d, cache, ntohl(ipv4));
+    }
+    else if(family == AF_INET6) {
+        stridx = vnm_lookup_v6_cached(d, cache, addr);
     }
     else {
-        stridx = ntree_lookup(d->tree, ainfo->ai_addr);
+        ERR("Client IP '%s' does not parse", ip_string);
     }
 
-    if(ainfo)
-        freeaddrinfo(ainfo);
+    return vnm_strdb_get(d->strdb, stridx);
+}
+
+const vnm_str_t* vnm_lookup_sa(const vnm_db_t* d, vnm_cache_t* cache, const struct sockaddr* sa) {
+    assert(d); assert(d->einst); assert(d->strdb); assert(sa);
+
+    unsigned stridx = 0; // default, no-match
+
+    if(sa->sa_family == AF_INET) {
+        const struct sockaddr_in* sin = (const struct sockaddr_in*)sa;
+        stridx = vnm_lookup_v4_cached(d, cache, ntohl(sin->sin_addr.s_addr));
+    }
+    else if(sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6* sin6 = (const struct sockaddr_in6*)sa;
+        stridx = vnm_lookup_v6_cached(d, cache, sin6->sin6_addr.s6_addr);
+    }
+    else {
+        ERR("Client IP has unsupported address family %u", (unsigned)sa->sa_family);
+    }
 
     return vnm_strdb_get(d->strdb, stridx);
 }
+
+// Addresses per engine batch call in vnm_lookup_batch()
+#define VNM_BATCH 32U
+
+static void vnm_batch_flush(const vnm_db_t* d, vnm_cache_t* cache, const unsigned npend, const uint8_t* pend_addrs, const unsigned* pend_idx, const vnm_str_t** results) {
+    unsigned pend_res[VNM_BATCH];
+    vnm_engine_lookup_batch(d->engine, d->einst, npend, pend_addrs, pend_res);
+    for(unsigned j = 0; j < npend; j++) {
+        if(cache)
+            vnm_cache_put(cache, d->generation, &pend_addrs[j * 16], pend_res[j]);
+        results[pend_idx[j]] = vnm_strdb_get(d->strdb, pend_res[j]);
+    }
+}
+
+void vnm_lookup_batch(const vnm_db_t* d, vnm_cache_t* cache, const unsigned n, const char* const* ip_strings, const vnm_str_t** results) {
+    assert(d); assert(d->einst); assert(d->strdb);
+    assert(ip_strings || !n); assert(results || !n);
+
+    // addresses waiting for the engine, and where their results go
+    uint8_t pend_addrs[VNM_BATCH * 16];
+    unsigned pend_idx[VNM_BATCH];
+    unsigned npend = 0;
+
+    for(unsigned i = 0; i < n; i++) {
+        unsigned stridx = 0; // default, no-match
+
+        // parse straight into the next pending slot, IPv4 as ::ffff:a.b.c.d
+        uint8_t* addr = &pend_addrs[npend * 16];
+        const int family = vnm_addr_parse(ip_strings[i], addr);
+        if(family == AF_INET) {
+            memmove(&addr[12], addr, 4);
+            memcpy(addr, start_v4mapped, 12);
+        }
+
+        uint32_t ipv4;
+        if(family != AF_INET && family != AF_INET6) {
+            ERR("Client IP '%s' does not parse", ip_strings[i]);
+        }
+        else if(d->v4dir && v6_v4fixup(addr, &ipv4)) {
+            stridx = ndir4_lookup(d->v4dir, ipv4);
+        }
+        else if(!cache || !vnm_cache_get(cache, d->generation, addr, &stridx)) {
+            pend_idx[npend++] = i;
+            if(npend == VNM_BATCH) {
+                vnm_batch_flush(d, cache, npend, pend_addrs, pend_idx, results);
+                npend = 0;
+            }
+            continue;
+        }
+
+        results[i] = vnm_strdb_get(d->strdb, stridx);
+    }
+
+    if(npend)
+        vnm_batch_flush(d, cache, npend, pend_addrs, pend_idx, results);
+}
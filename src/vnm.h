@@ -3,13 +3,95 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <stdbool.h>
 #include "vnm_strdb.h"
+#include "vnm_cache.h"
+#include "vnm_mmdb.h"
 
 typedef struct _vnm_db_struct vnm_db_t;
 
-vnm_db_t* vnm_db_parse(const char* fn, struct stat* db_stat);
+// Per-database load options, from a comma-separated "key=value" string
+//   (e.g. the optional last argument of VCL init()):
+//   engine=tree|poptrie|range|auto - main lookup structure (default tree),
+//                       "auto" picks one at each load, see vnm_engine.h
+//   v4table=16|24|off - also build a direct-indexed IPv4 table with a
+//                       2^N-entry first level (default off)
+//   cache=N           - callers should use a per-thread result cache of
+//                       at least N entries, 0 for none (default 0)
+//   pin=task|off      - callers should hold a reference to the database
+//                       for each whole request task and hand out result
+//                       strings without copying them (default off)
+//   build_threads=N|auto - build the tree from a loaded database with up to N
+//                       threads, "auto" for one per online CPU (default 1).
+//                       The result is identical either way.
+//   delta=on|off      - also apply "<database>.delta", an append-only log of
+//                       changes, and apply what's appended to it later with
+//                       vnm_db_update() rather than reloading everything
+//                       (default off).  JSON, text and MMDB databases,
+//                       engine=tree and v4table=off only, see vnm_delta.h.
+//   mmdb_key=PATH     - the field of an MMDB database's data records to use
+//                       as the string for their networks, see vnm_mmdb.h
+//                       (required for MMDB databases)
+typedef enum {
+    VNM_ENGINE_TREE = 0,
+    VNM_ENGINE_POPTRIE,
+    VNM_ENGINE_RANGE,
+    VNM_ENGINE_AUTO,
+} vnm_engine_id_t;
+
+typedef struct {
+    vnm_engine_id_t engine;
+    unsigned v4table_bits;
+    unsigned cache_entries;
+    bool pin_task;
+    unsigned build_threads; // 0 is the same as 1
+    bool delta;
+    char mmdb_key[VNM_MMDB_KEY_MAX]; // "" if none
+} vnm_opts_t;
+
+// NULL or "" sets defaults.  true retval means parse error (logged).
+bool vnm_opts_parse(const char* str, vnm_opts_t* opts);
+
+// "fn" may be a JSON, text (see vnm_text.h) or MMDB database, or one compiled by
+//   vnm_db_compile(), which is mmap()ed and used in place.  opts may be NULL for defaults.
+vnm_db_t* vnm_db_parse(const char* fn, struct stat* db_stat, const vnm_opts_t* opts);
 void vnm_db_destruct(vnm_db_t* n);
-const vnm_str_t* vnm_lookup(const vnm_db_t* d, const char* ip_string);
+
+// For a database loaded with delta=on, a new one with whatever has been
+//   appended to its delta file since applied, sharing most of its memory.
+//   "d" must be the newest database of its line (the last vnm_db_parse() or
+//   vnm_db_update() result).  NULL retval means there was nothing new, or
+//   an error (logged), or, if *reload_p was set, that the delta file was
+//   replaced or truncated and vnm_db_parse() must be used instead.  Always
+//   NULL for databases without delta=on.
+vnm_db_t* vnm_db_update(vnm_db_t* d, bool* reload_p);
+
+// Parses "in_fn" and writes it out to "out_fn" in the compiled binary
+//   format (see vnm_bin.h).  Only the build_threads and mmdb_key options
+//   are used from opts, which may be NULL.  true retval means error (logged).
+bool vnm_db_compile(const char* in_fn, const char* out_fn, const vnm_opts_t* opts);
+
+// Reference counting, for holding on to a database (and the result strings
+//   it returned) beyond an RCU read-side critical section.  vnm_db_parse()
+//   returns a database with one reference.  vnm_db_ref() must be called
+//   while the database is known to be live (e.g. from within the read-side
+//   critical section that found it), and vnm_db_unref() destructs it when
+//   the last reference goes.
+void vnm_db_ref(vnm_db_t* d);
+void vnm_db_unref(vnm_db_t* d);
+// Unique to each successful vnm_db_parse() in the process, never zero
+uint64_t vnm_db_generation(const vnm_db_t* d);
+
+// "cache" may be NULL for none
+const vnm_str_t* vnm_lookup(const vnm_db_t* d, vnm_cache_t* cache, const char* ip_string);
+const vnm_str_t* vnm_lookup_sa(const vnm_db_t* d, vnm_cache_t* cache, const struct sockaddr* sa);
+
+// Looks up "n" address strings at once, results[i] being what vnm_lookup()
+//   would return for ip_strings[i].  Tree walks for the addresses that
+//   aren't answered by the v4 table or the cache are overlapped, see
+//   ntree_lookup_batch().
+void vnm_lookup_batch(const vnm_db_t* d, vnm_cache_t* cache, const unsigned n, const char* const* ip_strings, const vnm_str_t** results);
 
 #endif // VNM_HDR
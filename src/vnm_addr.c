@@ -0,0 +1,255 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "vnm_addr.h"
+#include "ntree.h"
+
+// hex digit value, or -1
+static inline int hexval(const char c) {
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Strict dotted-quad, parsing up to "end" (exclusive).  No leading zeros
+//   on multi-digit octets, like inet_pton().  Returns true on failure.
+static bool parse_v4(const char* s, const char* end, uint8_t* out) {
+    assert(s); assert(end); assert(out);
+
+    unsigned octets = 0;
+    while(1) {
+        if(s == end || *s < '0' || *s > '9')
+            return true;
+        unsigned val = 0;
+        unsigned digits = 0;
+        while(s < end && *s >= '0' && *s <= '9') {
+            if(digits && !val)
+                return true; // leading zero
+            val = val * 10 + (unsigned)(*s++ - '0');
+            if(++digits > 3 || val > 255)
+                return true;
+        }
+        out[octets++] = (uint8_t)val;
+        if(octets == 4)
+            return s != end;
+        if(s == end || *s++ != '.')
+            return true;
+    }
+}
+
+// RFC 4291 section 2.2 text forms, parsing up to "end" (exclusive).
+//   Returns true on failure.
+static bool parse_v6(const char* s, const char* end, uint8_t* out) {
+    assert(s); assert(end); assert(out);
+
+    uint8_t words[16];
+    unsigned nbytes = 0; // bytes written to words[]
+    int gap = -1; // byte offset of "::", if seen
+
+    if(s < end && *s == ':') {
+        // only legal as the start of a leading "::"
+        if(s + 1 == end || s[1] != ':')
+            return true;
+        s += 2;
+        gap = 0;
+        if(s == end)
+            goto done; // "::"
+    }
+
+    while(1) {
+        if(nbytes == 16)
+            return true;
+
+        const char* grp = s;
+        unsigned val = 0;
+        int hv;
+        while(s < end && (hv = hexval(*s)) >= 0) {
+            val = (val << 4) | (unsigned)hv;
+            if(++s - grp > 4)
+                return true;
+        }
+
+        if(s == grp)
+            return true; // empty group
+
+        if(s < end && *s == '.') {
+            // trailing dotted-quad in the final 32 bits
+            if(nbytes > 12 || parse_v4(grp, end, &words[nbytes]))
+                return true;
+            nbytes += 4;
+            break;
+        }
+
+        words[nbytes++] = (uint8_t)(val >> 8);
+        words[nbytes++] = (uint8_t)(val & 0xFF);
+
+        if(s == end)
+            break;
+        if(*s++ != ':' || s == end)
+            return true;
+        if(*s == ':') {
+            if(gap >= 0)
+                return true; // only one "::" allowed
+            gap = (int)nbytes;
+            if(++s == end)
+                break; // trailing "::"
+        }
+    }
+
+done:
+    if(gap >= 0) {
+        if(nbytes == 16)
+            return true; // "::" must stand for at least one group
+        const unsigned tail = nbytes - (unsigned)gap;
+        memset(out, 0, 16);
+        memcpy(out, words, (unsigned)gap);
+        memcpy(&out[16 - tail], &words[gap], tail);
+    }
+    else {
+        if(nbytes != 16)
+            return true;
+        memcpy(out, words, 16);
+    }
+
+    return false;
+}
+
+int vnm_addr_parse(const char* str, uint8_t* out) {
+    assert(str); assert(out);
+
+    const char* end = str;
+    bool colon = false;
+    while(*end && *end != '%') {
+        if(*end == ':')
+            colon = true;
+        end++;
+    }
+
+    int rv = 0;
+
+    if(colon) {
+        // a zone suffix must be non-empty
+        if((!*end || end[1]) && !parse_v6(str, end, out))
+            rv = AF_INET6;
+    }
+    else if(!*end && !parse_v4(str, end, out)) {
+        rv = AF_INET;
+    }
+
+    return rv;
+}
+
+int vnm_cidr_parse(const char* str, uint8_t* out, unsigned* mask) {
+    assert(str); assert(out); assert(mask);
+
+    const char* end = str;
+    bool colon = false;
+    while(*end && *end != '/') {
+        if(*end == ':')
+            colon = true;
+        end++;
+    }
+
+    int rv = 0;
+    if(colon) {
+        if(!parse_v6(str, end, out))
+            rv = AF_INET6;
+    }
+    else if(!parse_v4(str, end, out)) {
+        rv = AF_INET;
+    }
+
+    if(!*end) {
+        *mask = (rv == AF_INET) ? 32 : 128;
+    }
+    else {
+        // 1-3 plain decimal digits
+        const char* m = end + 1;
+        unsigned val = 0;
+        unsigned digits = 0;
+        while(*m >= '0' && *m <= '9' && digits < 4) {
+            val = val * 10 + (unsigned)(*m++ - '0');
+            digits++;
+        }
+        if(!digits || digits > 3 || *m)
+            rv = 0;
+        *mask = val;
+    }
+
+    return rv;
+}
+
+static bool v6_subnet_of(const uint8_t* check, const unsigned check_mask, const uint8_t* v4, const unsigned v4_mask) {
+    assert(check); assert(v4);
+    assert(!(v4_mask & 7)); // all v4_mask are whole byte masks
+
+    bool rv = false;
+
+    if(check_mask >= v4_mask)
+        rv = !memcmp(check, v4, (v4_mask >> 3));
+
+    return rv;
+}
+
+bool vnm_net_v4like(const uint8_t* ipv6, const unsigned mask) {
+    assert(ipv6); assert(mask < 129);
+
+    return (
+          v6_subnet_of(ipv6, mask, start_v4mapped, 96)
+       || v6_subnet_of(ipv6, mask, start_siit, 96)
+       || v6_subnet_of(ipv6, mask, start_teredo, 32)
+       || v6_subnet_of(ipv6, mask, start_6to4, 16)
+    );
+}
+
+const char* vnm_net_parse(const char* str, uint8_t* ipv6, unsigned* mask) {
+    assert(str); assert(ipv6); assert(mask);
+
+    // straight into the v4compat position for IPv4
+    const int family = vnm_cidr_parse(str, ipv6, mask);
+    if(family == AF_INET6) {
+        if(*mask > 128)
+            return "has illegal netmask";
+        if(vnm_net_v4like(ipv6, *mask))
+            return "covers illegal IPv4-like space";
+    }
+    else if(family == AF_INET) {
+        if(*mask > 32)
+            return "has illegal netmask";
+        memcpy(&ipv6[12], ipv6, 4);
+        memset(ipv6, 0, 12);
+        *mask += 96;
+    }
+    else {
+        return "does not parse as addr/mask";
+    }
+
+    return NULL;
+}
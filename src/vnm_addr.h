@@ -0,0 +1,33 @@
+#ifndef VNM_ADDR_HDR
+#define VNM_ADDR_HDR
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Parse a numeric IPv4 or IPv6 address string into raw bytes, without
+//   touching the heap, the resolver, or any locks.  "out" must have room
+//   for 16 bytes.  Returns AF_INET (4 bytes of "out" written, network
+//   order), AF_INET6 (16 bytes written), or zero if the string does not
+//   parse.  IPv4 must be strict dotted-quad, IPv6 may use "::" compression
+//   and a trailing dotted-quad, and an IPv6 "%zone" suffix is ignored.
+int vnm_addr_parse(const char* str, uint8_t* out);
+
+// The same for "addr/mask" network strings from the database, where the
+//   mask is optional (full length if absent) and no zone is allowed.
+//   *mask is set to the mask as written, which the caller must check
+//   against the family's address length.
+int vnm_cidr_parse(const char* str, uint8_t* out, unsigned* mask);
+
+// A database network string, via vnm_cidr_parse(), placed where the lookup
+//   tree keeps it: 16 bytes of "ipv6" and a 0-128 *mask, with IPv4 in the
+//   v4compat ::/96.  IPv6 networks in or covering the v4-like spaces that
+//   lookups translate are rejected.  Returns NULL on success, or else the
+//   reason to log (e.g. "has illegal netmask").
+const char* vnm_net_parse(const char* str, uint8_t* ipv6, unsigned* mask);
+
+// Whether an IPv6 network lies within one of the v4-like spaces (v4mapped,
+//   SIIT, Teredo, 6to4) that lookups translate, which no database may
+//   define networks in
+bool vnm_net_v4like(const uint8_t* ipv6, const unsigned mask);
+
+#endif // VNM_ADDR_HDR
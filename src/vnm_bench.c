@@ -0,0 +1,534 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Microbenchmarks for the lookup path.  This builds a synthetic database
+//   of random prefixes directly through nlist (no input file needed), and
+//   then times the various lookup paths against a fixed set of random
+//   client addresses.  Not installed, build and run with "make bench".
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "vnm_addr.h"
+#include "vnm_engine.h"
+#include "vnm_rcu.h"
+#include "ntree.h"
+#include "ndir4.h"
+#include "nptrie.h"
+#include "nrange.h"
+#include "nlist.h"
+
+#define BENCH_KEYS 64
+
+typedef struct {
+    ntree_t* tree;
+    ndir4_t* dir16;
+    ndir4_t* dir24;
+    nptrie_t* ptrie;
+    nrange_t* range;
+    unsigned count;   // number of lookup addresses
+    char** strs;      // addresses in text form
+    uint8_t* addrs;   // addresses in raw form, 16 bytes each
+    uint8_t* mapped;  // the same, but IPv4 as ::ffff:a.b.c.d
+    int* families;    // AF_INET or AF_INET6, per address
+} bench_t;
+
+// xorshift64*, so runs are reproducible across libcs
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// TSC reference cycles where available, zero elsewhere
+static uint64_t now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Random global-unicast-ish IPv6 bits, avoiding the v4-like spaces
+static void rand_v6(uint8_t* ipv6) {
+    const uint64_t hi = rng();
+    const uint64_t lo = rng();
+    memcpy(ipv6, &hi, 8);
+    memcpy(&ipv6[8], &lo, 8);
+    ipv6[0] = 0x24 + (ipv6[0] % 7); // 2400:: -> 2aff::
+}
+
+static void rand_v4(uint8_t* ipv6) {
+    const uint32_t v4 = (uint32_t)rng();
+    memset(ipv6, 0, 12);
+    memcpy(&ipv6[12], &v4, 4);
+    ipv6[12] = 1 + (ipv6[12] % 223); // skip 0/8 and multicast+
+}
+
+// Rough prefix length mix of a full IPv6 BGP table, in percent
+static const struct { unsigned mask; unsigned pct; } v6_lengths[] = {
+    { 48, 46 }, { 44, 8 }, { 40, 7 }, { 36, 4 }, { 32, 16 },
+    { 29, 7 }, { 28, 3 }, { 46, 3 }, { 47, 2 }, { 24, 2 }, { 20, 2 },
+};
+
+static unsigned rand_v6_mask(void) {
+    unsigned r = (unsigned)(rng() % 100);
+    for(unsigned i = 0; i < sizeof(v6_lengths) / sizeof(v6_lengths[0]); i++) {
+        if(r < v6_lengths[i].pct)
+            return v6_lengths[i].mask;
+        r -= v6_lengths[i].pct;
+    }
+    return 48;
+}
+
+static nlist_t* make_list(const unsigned nv4, const unsigned nv6) {
+    nlist_t* nl = nlist_new();
+    uint8_t ipv6[16];
+
+    for(unsigned i = 0; i < nv4; i++) {
+        rand_v4(ipv6);
+        nlist_append(nl, ipv6, 96 + 8 + (unsigned)(rng() % 17), 1 + (unsigned)(rng() % BENCH_KEYS));
+    }
+    for(unsigned i = 0; i < nv6; i++) {
+        rand_v6(ipv6);
+        nlist_append(nl, ipv6, rand_v6_mask(), 1 + (unsigned)(rng() % BENCH_KEYS));
+    }
+
+    // same undefined spaces as vnm_db_parse()
+    nlist_append(nl, start_v4mapped, 96, NN_UNDEF);
+    nlist_append(nl, start_siit, 96, NN_UNDEF);
+    nlist_append(nl, start_6to4, 16, NN_UNDEF);
+    nlist_append(nl, start_teredo, 32, NN_UNDEF);
+    nlist_finish(nl);
+    return nl;
+}
+
+// Times the tree build from the same list with 1..max_threads threads,
+//   checking each result against the reference tree.
+static void bench_build(const nlist_t* nl, const ntree_t* ref, const unsigned max_threads) {
+    for(unsigned t = 1; t <= max_threads; t <<= 1) {
+        const double start = now_ns();
+        ntree_t* tree = nlist_xlate_tree(nl, t);
+        const double ns = now_ns() - start;
+        if(tree->count != ref->count || memcmp(tree->store, ref->store, ref->count * sizeof(nnode_t))) {
+            fprintf(stderr, "nlist_xlate_tree with %u threads: result differs from 1 thread!\n", t);
+            exit(1);
+        }
+        printf("  %3u threads: %9.2f ms\n", t, ns / 1e6);
+        ntree_destroy(tree);
+    }
+}
+
+static void make_addrs(bench_t* b, const unsigned count, const unsigned v6_pct) {
+    b->count = count;
+    b->strs = malloc(count * sizeof(char*));
+    b->addrs = malloc(count * 16);
+    b->mapped = malloc(count * 16);
+    b->families = malloc(count * sizeof(int));
+
+    char buf[INET6_ADDRSTRLEN];
+    for(unsigned i = 0; i < count; i++) {
+        uint8_t* a = &b->addrs[i * 16];
+        if(rng() % 100 < v6_pct) {
+            rand_v6(a);
+            b->families[i] = AF_INET6;
+            memcpy(&b->mapped[i * 16], a, 16);
+            inet_ntop(AF_INET6, a, buf, sizeof(buf));
+        }
+        else {
+            rand_v4(a);
+            memcpy(&b->mapped[i * 16], start_v4mapped, 12);
+            memcpy(&b->mapped[i * 16 + 12], &a[12], 4);
+            memmove(a, &a[12], 4);
+            b->families[i] = AF_INET;
+            inet_ntop(AF_INET, a, buf, sizeof(buf));
+        }
+        b->strs[i] = strdup(buf);
+    }
+}
+
+static void free_addrs(bench_t* b) {
+    for(unsigned i = 0; i < b->count; i++)
+        free(b->strs[i]);
+    free(b->strs);
+    free(b->addrs);
+    free(b->mapped);
+    free(b->families);
+}
+
+typedef unsigned (*bench_fn_t)(const bench_t* b, const unsigned i);
+
+// Every alternative lookup structure must agree with the ntree exactly
+static unsigned bench_ntree_raw(const bench_t* b, const unsigned i);
+static void verify(const char* name, const bench_t* b, bench_fn_t fn) {
+    for(unsigned i = 0; i < b->count; i++) {
+        if(fn(b, i) != bench_ntree_raw(b, i)) {
+            fprintf(stderr, "%s: result mismatch vs ntree for %s!\n", name, b->strs[i]);
+            exit(1);
+        }
+    }
+}
+
+static void run(const char* name, const bench_t* b, const unsigned rounds, bench_fn_t fn) {
+    unsigned sink = 0;
+
+    // one warmup round
+    for(unsigned i = 0; i < b->count; i++)
+        sink += fn(b, i);
+
+    const double start = now_ns();
+    const uint64_t start_cyc = now_cycles();
+    for(unsigned r = 0; r < rounds; r++)
+        for(unsigned i = 0; i < b->count; i++)
+            sink += fn(b, i);
+    const uint64_t elapsed_cyc = now_cycles() - start_cyc;
+    const double elapsed = now_ns() - start;
+
+    const double n = (double)rounds * b->count;
+    if(elapsed_cyc)
+        printf("%-32s %9.1f ns/lookup %9.1f cycles/lookup  (sink %u)\n", name,
+            elapsed / n, (double)elapsed_cyc / n, sink);
+    else
+        printf("%-32s %9.1f ns/lookup  (sink %u)\n", name, elapsed / n, sink);
+}
+
+/***************
+ * Bench cases *
+ ***************/
+
+// The pre-1.10 vnm_lookup() path
+static unsigned bench_getaddrinfo(const bench_t* b, const unsigned i) {
+    const struct addrinfo hints = {
+        .ai_flags = AI_NUMERICHOST,
+        .ai_family = AF_UNSPEC,
+    };
+    struct addrinfo* ainfo = NULL;
+    unsigned rv = 0;
+    if(!getaddrinfo(b->strs[i], NULL, &hints, &ainfo))
+        rv = ntree_lookup(b->tree, ainfo->ai_addr);
+    if(ainfo)
+        freeaddrinfo(ainfo);
+    return rv;
+}
+
+static unsigned bench_parse(const bench_t* b, const unsigned i) {
+    uint8_t addr[16];
+    unsigned rv = 0;
+    const int family = vnm_addr_parse(b->strs[i], addr);
+    if(family == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, addr, 4);
+        rv = ntree_lookup_v4(b->tree, ntohl(ipv4));
+    }
+    else if(family == AF_INET6) {
+        rv = ntree_lookup_v6(b->tree, addr);
+    }
+    return rv;
+}
+
+static unsigned bench_parse_only(const bench_t* b, const unsigned i) {
+    uint8_t addr[16];
+    return (unsigned)vnm_addr_parse(b->strs[i], addr) + addr[3];
+}
+
+static unsigned bench_ntree_raw(const bench_t* b, const unsigned i) {
+    const uint8_t* a = &b->addrs[i * 16];
+    if(b->families[i] == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, a, 4);
+        return ntree_lookup_v4(b->tree, ntohl(ipv4));
+    }
+    return ntree_lookup_v6(b->tree, a);
+}
+
+static unsigned bench_ndir4(const ndir4_t* dir, const bench_t* b, const unsigned i) {
+    const uint8_t* a = &b->addrs[i * 16];
+    if(b->families[i] == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, a, 4);
+        return ndir4_lookup(dir, ntohl(ipv4));
+    }
+    uint32_t ipv4;
+    return v6_v4fixup(a, &ipv4) ? ndir4_lookup(dir, ipv4) : ntree_lookup_v6(b->tree, a);
+}
+
+static unsigned bench_ndir4_16(const bench_t* b, const unsigned i) {
+    return bench_ndir4(b->dir16, b, i);
+}
+
+static unsigned bench_ndir4_24(const bench_t* b, const unsigned i) {
+    return bench_ndir4(b->dir24, b, i);
+}
+
+static unsigned bench_nptrie(const bench_t* b, const unsigned i) {
+    const uint8_t* a = &b->addrs[i * 16];
+    if(b->families[i] == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, a, 4);
+        return nptrie_lookup_v4(b->ptrie, ntohl(ipv4));
+    }
+    return nptrie_lookup_v6(b->ptrie, a);
+}
+
+static unsigned bench_nrange(const bench_t* b, const unsigned i) {
+    const uint8_t* a = &b->addrs[i * 16];
+    if(b->families[i] == AF_INET) {
+        uint32_t ipv4;
+        memcpy(&ipv4, a, 4);
+        return nrange_lookup_v4(b->range, ntohl(ipv4));
+    }
+    return nrange_lookup_v6(b->range, a);
+}
+
+// ntree_lookup_batch() on each run of "n" addresses, handing the results
+//   out one at a time so it fits run() and verify()
+static unsigned bench_ntree_batch(const bench_t* b, const unsigned i, const unsigned n) {
+    static unsigned results[32];
+    assert(n <= 32);
+    if(!(i % n)) {
+        const unsigned count = (b->count - i) < n ? (b->count - i) : n;
+        ntree_lookup_batch(b->tree, count, &b->mapped[i * 16], results);
+    }
+    return results[i % n];
+}
+
+static unsigned bench_ntree_batch8(const bench_t* b, const unsigned i) {
+    return bench_ntree_batch(b, i, 8);
+}
+
+static unsigned bench_ntree_batch32(const bench_t* b, const unsigned i) {
+    return bench_ntree_batch(b, i, 32);
+}
+
+/***********************
+ * Reader-side scaling *
+ ***********************/
+
+// The reader threads look up through an RCU-protected pointer, flipping
+//   between two copies of the tree, which an updater thread swaps every
+//   millisecond as if reloading.  With "protect" unset they use the tree
+//   directly instead, as the baseline.
+typedef struct {
+    const bench_t* b;
+    ntree_t* trees[2];
+    ntree_t* cur;
+    vnm_rcu_t rcu;
+    unsigned rounds;
+    bool protect;
+    bool stop;
+    unsigned updates;
+    unsigned sink;
+} readers_t;
+
+static ntree_t* copy_tree(const ntree_t* tree) {
+    ntree_t* copy = malloc(sizeof(ntree_t));
+    *copy = *tree;
+    void* mem = NULL;
+    if(posix_memalign(&mem, 64, tree->count * sizeof(nnode_t)))
+        abort();
+    memcpy(mem, tree->store, tree->count * sizeof(nnode_t));
+    copy->store = mem;
+    return copy;
+}
+
+static void* reader_thread(void* rs_asvoid) {
+    readers_t* rs = rs_asvoid;
+    const bench_t* b = rs->b;
+    unsigned sink = 0;
+
+    vnm_rcu_register_thread();
+    for(unsigned r = 0; r < rs->rounds; r++) {
+        for(unsigned i = 0; i < b->count; i++) {
+            if(rs->protect) {
+                const unsigned t = vnm_rcu_read_lock(&rs->rcu);
+                const ntree_t* tree = vnm_rcu_dereference(rs->cur);
+                sink += ntree_lookup_v6(tree, &b->mapped[i * 16]);
+                vnm_rcu_read_unlock(&rs->rcu, t);
+            }
+            else {
+                sink += ntree_lookup_v6(rs->trees[0], &b->mapped[i * 16]);
+            }
+        }
+    }
+    vnm_rcu_unregister_thread();
+
+    __atomic_add_fetch(&rs->sink, sink, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void* updater_thread(void* rs_asvoid) {
+    readers_t* rs = rs_asvoid;
+    unsigned which = 0;
+    while(!__atomic_load_n(&rs->stop, __ATOMIC_RELAXED)) {
+        usleep(1000);
+        which ^= 1U;
+        vnm_rcu_assign_pointer(rs->cur, rs->trees[which]);
+        vnm_rcu_synchronize(&rs->rcu);
+        rs->updates++;
+    }
+    return NULL;
+}
+
+static void bench_readers(readers_t* rs, const unsigned nthreads) {
+    pthread_t readers[nthreads];
+    pthread_t updater;
+
+    rs->stop = false;
+    rs->updates = 0;
+    rs->sink = 0;
+    pthread_create(&updater, NULL, updater_thread, rs);
+
+    const double start = now_ns();
+    for(unsigned i = 0; i < nthreads; i++)
+        pthread_create(&readers[i], NULL, reader_thread, rs);
+    for(unsigned i = 0; i < nthreads; i++)
+        pthread_join(readers[i], NULL);
+    const double elapsed = now_ns() - start;
+
+    __atomic_store_n(&rs->stop, true, __ATOMIC_RELAXED);
+    pthread_join(updater, NULL);
+
+    const double per_thread = (double)rs->rounds * rs->b->count;
+    printf("%-10s %3u threads %9.1f ns/lookup/thread %9.2f Mlookups/s  (%u updates, sink %u)\n",
+        rs->protect ? vnm_rcu_scheme() : "none", nthreads,
+        elapsed / per_thread, per_thread * nthreads / elapsed * 1e3,
+        rs->updates, rs->sink);
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-4 v4_prefixes] [-6 v6_prefixes] [-n lookups] [-r rounds] [-p v6_percent] [-t max_threads]\n", argv0);
+    exit(99);
+}
+
+int main(int argc, char* argv[]) {
+    unsigned nv4 = 100000;
+    unsigned nv6 = 20000;
+    unsigned lookups = 100000;
+    unsigned rounds = 10;
+    unsigned v6_pct = 20;
+    unsigned max_threads = 8;
+
+    int opt;
+    while((opt = getopt(argc, argv, "4:6:n:r:p:t:")) != -1) {
+        switch(opt) {
+            case '4': nv4 = (unsigned)atoi(optarg); break;
+            case '6': nv6 = (unsigned)atoi(optarg); break;
+            case 'n': lookups = (unsigned)atoi(optarg); break;
+            case 'r': rounds = (unsigned)atoi(optarg); break;
+            case 'p': v6_pct = (unsigned)atoi(optarg); break;
+            case 't': max_threads = (unsigned)atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(!lookups || !rounds || v6_pct > 100 || !max_threads)
+        usage(argv[0]);
+
+    bench_t b;
+    nlist_t* nl = make_list(nv4, nv6);
+    b.tree = nlist_xlate_tree(nl, 1);
+    make_addrs(&b, lookups, v6_pct);
+    b.dir16 = ndir4_new(b.tree, 16);
+    b.dir24 = ndir4_new(b.tree, 24);
+    verify("ntree_lookup_batch/8", &b, bench_ntree_batch8);
+    verify("ntree_lookup_batch/32", &b, bench_ntree_batch32);
+    verify("ndir4/16", &b, bench_ndir4_16);
+    verify("ndir4/24", &b, bench_ndir4_24);
+    b.ptrie = nptrie_new(b.tree);
+    verify("nptrie", &b, bench_nptrie);
+    b.range = nrange_new(b.tree);
+    verify("nrange", &b, bench_nrange);
+
+    printf("%u v4 + %u v6 prefixes, %u tree nodes, %u addresses (%u%% v6) x %u rounds\n",
+        nv4, nv6, b.tree->count, lookups, v6_pct, rounds);
+
+    run("getaddrinfo + ntree_lookup", &b, rounds, bench_getaddrinfo);
+    run("vnm_addr_parse + ntree_lookup", &b, rounds, bench_parse);
+    run("vnm_addr_parse only", &b, rounds, bench_parse_only);
+    run("ntree_lookup only", &b, rounds, bench_ntree_raw);
+    run("ntree_lookup_batch, 8 at a time", &b, rounds, bench_ntree_batch8);
+    run("ntree_lookup_batch, 32 at a time", &b, rounds, bench_ntree_batch32);
+    run("ndir4/16 (v4, v6 via ntree)", &b, rounds, bench_ndir4_16);
+    run("ndir4/24 (v4, v6 via ntree)", &b, rounds, bench_ndir4_24);
+    run("nptrie", &b, rounds, bench_nptrie);
+    run("nrange", &b, rounds, bench_nrange);
+
+    printf("memory: ntree %zu KiB, ndir4/16 %zu KiB, ndir4/24 %zu KiB, nptrie %zu KiB, nrange %zu KiB\n",
+        (size_t)b.tree->count * sizeof(nnode_t) / 1024,
+        ndir4_size(b.dir16) / 1024, ndir4_size(b.dir24) / 1024,
+        nptrie_size(b.ptrie) / 1024, nrange_size(b.range) / 1024);
+
+    void* auto_inst;
+    const vnm_engine_t* auto_eng = vnm_engine_auto(b.tree, &auto_inst);
+    printf("engine=auto picks: %s\n", auto_eng->name);
+    if(auto_eng != &vnm_engine_tree)
+        auto_eng->destroy(auto_inst);
+
+    printf("reader side, %s reclamation vs unprotected, with an update every 1ms:\n", vnm_rcu_scheme());
+    readers_t rs = {
+        .b = &b,
+        .trees = { b.tree, copy_tree(b.tree) },
+        .cur = b.tree,
+        .rounds = rounds,
+    };
+    vnm_rcu_init(&rs.rcu);
+    for(unsigned t = 1; t <= max_threads; t <<= 1) {
+        rs.protect = false;
+        bench_readers(&rs, t);
+        rs.protect = true;
+        bench_readers(&rs, t);
+    }
+    ntree_destroy(rs.trees[1]);
+
+    printf("tree build from the normalized list:\n");
+    bench_build(nl, b.tree, max_threads);
+    nlist_destroy(nl);
+
+    nrange_destroy(b.range);
+    nptrie_destroy(b.ptrie);
+    ndir4_destroy(b.dir16);
+    ndir4_destroy(b.dir24);
+    free_addrs(&b);
+    ntree_destroy(b.tree);
+    return 0;
+}
@@ -0,0 +1,243 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_log.h"
+#include "vnm_bin.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    // VNM_BIN_BYTE_ORDER, as written
+    uint64_t size;          // of the whole file
+    uint64_t checksum;
+    uint32_t node_count;
+    uint32_t str_count;
+    uint64_t nodes_off;
+    uint64_t strs_off;
+    uint64_t str_data_off;
+    uint64_t str_data_len;
+    uint8_t pad[56];
+} vnm_bin_hdr_t;
+
+typedef struct {
+    uint32_t offset; // into the string data
+    uint32_t len;    // includes the NUL, as vnm_str_t
+} vnm_bin_str_t;
+
+_Static_assert(sizeof(vnm_bin_hdr_t) == 128, "vnm_bin_hdr_t must be 128 bytes");
+_Static_assert(sizeof(nnode_t) == 8, "nnode_t layout changed, bump VNM_BIN_VERSION");
+
+#define VNM_BIN_BYTE_ORDER 0x01020304U
+
+#define FNV64_INIT 0xCBF29CE484222325ULL
+static uint64_t fnv64(uint64_t h, const void* data, const size_t len) {
+    const uint8_t* p = data;
+    for(size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+bool vnm_bin_detect(const char* fn) {
+    assert(fn);
+
+    bool rv = false;
+    char magic[8];
+    FILE* fp = fopen(fn, "r");
+    if(fp) {
+        rv = fread(magic, 1, 8, fp) == 8 && !memcmp(magic, VNM_BIN_MAGIC, 8);
+        fclose(fp);
+    }
+    return rv;
+}
+
+bool vnm_bin_write(const char* fn, const ntree_t* tree, const vnm_strdb_t* strdb) {
+    assert(fn); assert(tree); assert(strdb);
+    assert(!tree->alloc); // ntree_finish() was called
+    assert(!tree->root); // and never updated in place since
+
+    // string table, and the string data as is
+    size_t str_data_len;
+    const char* str_data = vnm_strdb_arena(strdb, &str_data_len);
+    assert(str_data); // finished
+    const unsigned str_count = vnm_strdb_count(strdb);
+    vnm_bin_str_t* strs = calloc(str_count, sizeof(vnm_bin_str_t));
+    for(unsigned i = 1; i < str_count; i++) {
+        const vnm_str_t* s = vnm_strdb_get(strdb, i);
+        strs[i].offset = (uint32_t)(s->data - str_data);
+        strs[i].len = s->len;
+    }
+
+    vnm_bin_hdr_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, VNM_BIN_MAGIC, 8);
+    hdr.version = VNM_BIN_VERSION;
+    hdr.byte_order = VNM_BIN_BYTE_ORDER;
+    hdr.node_count = tree->count;
+    hdr.str_count = str_count;
+    hdr.nodes_off = sizeof(hdr);
+    hdr.strs_off = hdr.nodes_off + (uint64_t)tree->count * sizeof(nnode_t);
+    hdr.str_data_off = hdr.strs_off + (uint64_t)str_count * sizeof(vnm_bin_str_t);
+    hdr.str_data_len = str_data_len;
+    hdr.size = hdr.str_data_off + str_data_len;
+
+    uint64_t sum = FNV64_INIT;
+    sum = fnv64(sum, tree->store, tree->count * sizeof(nnode_t));
+    sum = fnv64(sum, strs, str_count * sizeof(vnm_bin_str_t));
+    sum = fnv64(sum, str_data, str_data_len);
+    hdr.checksum = sum;
+
+    const size_t fnlen = strlen(fn);
+    char tmpfn[fnlen + 5];
+    memcpy(tmpfn, fn, fnlen);
+    memcpy(&tmpfn[fnlen], ".tmp", 5);
+
+    bool rv = true;
+    FILE* fp = fopen(tmpfn, "w");
+    if(!fp) {
+        ERR("Failed to open '%s' for writing: %s", tmpfn, strerror(errno));
+    }
+    else {
+        const bool wfail =
+               fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+            || fwrite(tree->store, sizeof(nnode_t), tree->count, fp) != tree->count
+            || fwrite(strs, sizeof(vnm_bin_str_t), str_count, fp) != str_count
+            || (str_data_len && fwrite(str_data, str_data_len, 1, fp) != 1);
+        if(fclose(fp) || wfail)
+            ERR("Failed to write '%s': %s", tmpfn, strerror(errno));
+        else if(rename(tmpfn, fn))
+            ERR("Failed to rename '%s' to '%s': %s", tmpfn, fn, strerror(errno));
+        else
+            rv = false;
+        if(rv)
+            unlink(tmpfn);
+    }
+
+    free(strs);
+    return rv;
+}
+
+bool vnm_bin_load(const char* fn, void** map_p, size_t* map_len_p, ntree_t** tree_p, vnm_strdb_t** strdb_p) {
+    assert(fn); assert(map_p); assert(map_len_p); assert(tree_p); assert(strdb_p);
+
+    const int fd = open(fn, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        ERR("Failed to open compiled database %s: %s", fn, strerror(errno));
+        return true;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st)) {
+        ERR("Failed to fstat() compiled database %s: %s", fn, strerror(errno));
+        close(fd);
+        return true;
+    }
+
+    const size_t len = (size_t)st.st_size;
+    if(len < sizeof(vnm_bin_hdr_t)) {
+        ERR("Compiled database %s is truncated", fn);
+        close(fd);
+        return true;
+    }
+
+    void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        ERR("Failed to mmap() compiled database %s: %s", fn, strerror(errno));
+        return true;
+    }
+
+    const uint8_t* base = map;
+    const vnm_bin_hdr_t* hdr = map;
+    const char* fail = NULL;
+
+    if(memcmp(hdr->magic, VNM_BIN_MAGIC, 8))
+        fail = "bad magic";
+    else if(hdr->version != VNM_BIN_VERSION)
+        fail = "unsupported version";
+    else if(hdr->byte_order != VNM_BIN_BYTE_ORDER)
+        fail = "written on a host of different byte order";
+    else if(hdr->size != len)
+        fail = "size mismatch";
+    else if(!hdr->str_count
+        || hdr->nodes_off != sizeof(vnm_bin_hdr_t)
+        || hdr->strs_off != hdr->nodes_off + (uint64_t)hdr->node_count * sizeof(nnode_t)
+        || hdr->str_data_off != hdr->strs_off + (uint64_t)hdr->str_count * sizeof(vnm_bin_str_t)
+        || hdr->str_data_off + hdr->str_data_len != len)
+        fail = "bad section layout";
+    else if(fnv64(FNV64_INIT, &base[sizeof(vnm_bin_hdr_t)], len - sizeof(vnm_bin_hdr_t)) != hdr->checksum)
+        fail = "checksum mismatch";
+
+    // strings, checked and wrapped
+    vnm_str_t* strings = NULL;
+    if(!fail) {
+        const vnm_bin_str_t* strs = (const vnm_bin_str_t*)&base[hdr->strs_off];
+        const char* str_data = (const char*)&base[hdr->str_data_off];
+        strings = calloc(hdr->str_count, sizeof(vnm_str_t));
+        if(strs[0].offset || strs[0].len)
+            fail = "bad no-match string";
+        for(unsigned i = 1; !fail && i < hdr->str_count; i++) {
+            if(!strs[i].len
+                || (uint64_t)strs[i].offset + strs[i].len > hdr->str_data_len
+                || str_data[strs[i].offset + strs[i].len - 1])
+                fail = "bad string table";
+            strings[i].len = strs[i].len;
+            strings[i].data = (char*)&str_data[strs[i].offset];
+        }
+    }
+
+    // and the tree
+    ntree_t* tree = NULL;
+    if(!fail) {
+        tree = ntree_from_store((nnode_t*)&base[hdr->nodes_off], hdr->node_count, hdr->str_count);
+        if(!tree)
+            fail = "bad tree";
+    }
+
+    if(fail) {
+        ERR("Compiled database %s is invalid: %s", fn, fail);
+        free(strings);
+        munmap(map, len);
+        return true;
+    }
+
+    *map_p = map;
+    *map_len_p = len;
+    *tree_p = tree;
+    *strdb_p = vnm_strdb_new_borrowed(strings, hdr->str_count, (const char*)&base[hdr->str_data_off], hdr->str_data_len);
+    return false;
+}
+
+void vnm_bin_unmap(void* map, const size_t map_len) {
+    assert(map);
+    munmap(map, map_len);
+}
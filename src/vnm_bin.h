@@ -0,0 +1,62 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_BIN_HDR
+#define VNM_BIN_HDR
+
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vnm_strdb.h"
+#include "ntree.h"
+
+// Compiled database files, as written by "vnm_validate -c": the finished
+//   ntree store and the string table, laid out so that the file can be
+//   mmap()ed and used in place, with no parsing.  The layout is:
+//
+//   vnm_bin_hdr_t, padded to 128 bytes
+//   node_count x nnode_t (64-byte aligned)
+//   str_count x { uint32_t offset, uint32_t len } (index zero is no-match)
+//   str_data_len bytes of NUL-terminated strings
+//
+// All offsets are from the start of the file, and all integers are in
+//   the writer's byte order, which must match the reader's.  The checksum
+//   is FNV-1a (64 bit) over everything after the header.
+
+#define VNM_BIN_MAGIC "VNMDBIN\n"
+#define VNM_BIN_VERSION 1U
+
+// Just the magic, so vnm_db_parse() can tell these from JSON
+bool vnm_bin_detect(const char* fn);
+
+// Writes a compiled database, via a temporary file and rename(), so that
+//   a running reader never maps a partial file.  true retval means error
+//   (logged).
+bool vnm_bin_write(const char* fn, const ntree_t* tree, const vnm_strdb_t* strdb);
+
+// Maps a compiled database read-only and checks it, setting up a tree and
+//   strdb which point into the mapping.  true retval means error (logged).
+//   On success, *map_p / *map_len_p must be passed to vnm_bin_unmap() once
+//   the tree and strdb are destroyed.
+bool vnm_bin_load(const char* fn, void** map_p, size_t* map_len_p, ntree_t** tree_p, vnm_strdb_t** strdb_p);
+
+void vnm_bin_unmap(void* map, const size_t map_len);
+
+#endif // VNM_BIN_HDR
@@ -0,0 +1,64 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+#include "vnm_cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+// process-wide totals, only touched on flush
+static uint64_t total_hits = 0;
+static uint64_t total_misses = 0;
+
+vnm_cache_t* vnm_cache_new(const unsigned entries) {
+    assert(entries);
+
+    unsigned bits = 1;
+    while((1U << bits) < entries)
+        bits++;
+
+    vnm_cache_t* c = malloc(sizeof(vnm_cache_t));
+    c->ents = calloc(1U << bits, sizeof(vnm_cache_ent_t));
+    c->bits = bits;
+    c->hits = 0;
+    c->misses = 0;
+    return c;
+}
+
+void vnm_cache_destroy(vnm_cache_t* c) {
+    assert(c);
+    vnm_cache_flush_stats(c);
+    free(c->ents);
+    free(c);
+}
+
+void vnm_cache_flush_stats(vnm_cache_t* c) {
+    assert(c);
+    __atomic_add_fetch(&total_hits, c->hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total_misses, c->misses, __ATOMIC_RELAXED);
+    c->hits = 0;
+    c->misses = 0;
+}
+
+void vnm_cache_totals(uint64_t* hits, uint64_t* misses) {
+    assert(hits); assert(misses);
+    *hits = __atomic_load_n(&total_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&total_misses, __ATOMIC_RELAXED);
+}
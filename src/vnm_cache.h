@@ -0,0 +1,80 @@
+#ifndef VNM_CACHE_HDR
+#define VNM_CACHE_HDR
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+// A small direct-mapped cache of lookup results (string indices), meant
+//   to be owned by a single thread, so no locking at all.  Entries are
+//   keyed on the 16-byte address (IPv4 as ::ffff:a.b.c.d) and the
+//   generation of the database that produced them.  Every database load
+//   gets a new generation (see vnm_db_generation()), so a reload or a
+//   different database never sees another's entries, and nothing needs
+//   to be flushed.
+
+typedef struct {
+    uint64_t gen; // zero for unused
+    uint64_t key[2];
+    uint32_t idx;
+    uint32_t pad_;
+} vnm_cache_ent_t;
+
+typedef struct {
+    vnm_cache_ent_t* ents;
+    unsigned bits; // log2 of entry count
+    unsigned hits; // not yet added to the totals
+    unsigned misses; // not yet added to the totals
+} vnm_cache_t;
+
+// "entries" is rounded up to a power of two
+vnm_cache_t* vnm_cache_new(const unsigned entries);
+void vnm_cache_destroy(vnm_cache_t* c);
+
+// Entry count, for callers deciding whether to replace it with a larger one
+static inline unsigned vnm_cache_entries(const vnm_cache_t* c) {
+    return 1U << c->bits;
+}
+
+// Adds this cache's pending hit/miss counts to the process-wide totals
+void vnm_cache_flush_stats(vnm_cache_t* c);
+
+// Process-wide totals, as of each cache's last flush, which happens
+//   every VNM_CACHE_FLUSH_EVERY lookups and on vnm_cache_destroy()
+void vnm_cache_totals(uint64_t* hits, uint64_t* misses);
+#define VNM_CACHE_FLUSH_EVERY 1024U
+
+static inline vnm_cache_ent_t* vnm_cache_slot(const vnm_cache_t* c, const uint64_t gen, const uint64_t* key) {
+    uint64_t h = (key[0] ^ (key[1] * 0x9E3779B97F4A7C15ULL) ^ gen) * 0xBF58476D1CE4E5B9ULL;
+    return &c->ents[h >> (64U - c->bits)];
+}
+
+// true on hit, with the result in *idx
+static inline bool vnm_cache_get(vnm_cache_t* c, const uint64_t gen, const uint8_t* addr, unsigned* idx) {
+    uint64_t key[2];
+    memcpy(key, addr, 16);
+    const vnm_cache_ent_t* e = vnm_cache_slot(c, gen, key);
+    const bool hit = e->gen == gen && e->key[0] == key[0] && e->key[1] == key[1];
+    if(hit) {
+        *idx = e->idx;
+        c->hits++;
+    }
+    else {
+        c->misses++;
+    }
+    if(c->hits + c->misses >= VNM_CACHE_FLUSH_EVERY)
+        vnm_cache_flush_stats(c);
+    return hit;
+}
+
+static inline void vnm_cache_put(vnm_cache_t* c, const uint64_t gen, const uint8_t* addr, const unsigned idx) {
+    uint64_t key[2];
+    memcpy(key, addr, 16);
+    vnm_cache_ent_t* e = vnm_cache_slot(c, gen, key);
+    e->gen = gen;
+    e->key[0] = key[0];
+    e->key[1] = key[1];
+    e->idx = idx;
+}
+
+#endif // VNM_CACHE_HDR
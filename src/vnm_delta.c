@@ -0,0 +1,396 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_log.h"
+#include "vnm_delta.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "vnm_addr.h"
+
+// Least spare room, in nodes, left after the tree in a new store
+#define VNM_DELTA_SPARE_MIN 65536U
+
+// A node store, shared by the versions built in it
+typedef struct {
+    nnode_t* nodes;
+    unsigned alloc;
+    unsigned refs; // versions, plus one while it's the lineage's current store
+} vnm_delta_store_t;
+
+// Everything shared by the versions made from one base load.  Only the
+//   updater (the caller of vnm_delta_new() and vnm_delta_update()) touches
+//   anything but the refcount.
+typedef struct {
+    char* fn; // of the delta file
+    nlist_t* base;
+    nlist_t* ovl; // the changes so far, NULL if none
+    vnm_strdb_t* strdb; // keys, added to by the delta file
+    vnm_delta_store_t* st; // the store new versions go in
+    unsigned root; // of the newest version
+    unsigned count; // nodes of st in use by the newest version
+    // the delta file as consumed so far
+    bool seen;
+    dev_t dev;
+    ino_t ino;
+    off_t off;
+    unsigned lines;
+    // its size and mtime at the last read, to skip unchanged files
+    off_t tried_size;
+    time_t tried_mtime;
+    unsigned refs; // versions
+} vnm_delta_sh_t;
+
+struct _vnm_delta {
+    vnm_delta_sh_t* sh;
+    vnm_delta_store_t* st;
+    unsigned count; // nodes of st it uses
+};
+
+static void store_unref(vnm_delta_store_t* st) {
+    if(!__atomic_sub_fetch(&st->refs, 1, __ATOMIC_ACQ_REL)) {
+        free(st->nodes);
+        free(st);
+    }
+}
+
+// A new store holding a compact copy of "tree", with spare room after it
+static vnm_delta_store_t* store_new(const ntree_t* tree, unsigned spare, unsigned* count_p) {
+    const unsigned limit = (1U << 24) - 1U - tree->count;
+    if(spare > limit)
+        spare = limit;
+    vnm_delta_store_t* st = malloc(sizeof(vnm_delta_store_t));
+    st->nodes = ntree_compact(tree, spare, count_p);
+    st->alloc = *count_p + spare;
+    st->refs = 1;
+    return st;
+}
+
+static unsigned spare_for(const unsigned count, const unsigned need) {
+    unsigned spare = count >> 2;
+    if(spare < VNM_DELTA_SPARE_MIN)
+        spare = VNM_DELTA_SPARE_MIN;
+    if(spare < (need << 1))
+        spare = need << 1;
+    return spare;
+}
+
+static char* skip_ws(char* p) {
+    while(*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+static char* skip_token(char* p) {
+    while(*p && *p != ' ' && *p != '\t')
+        p++;
+    return p;
+}
+
+// One line, without its newline, into "chg".  true retval means error
+//   (logged).
+static bool delta_line(vnm_delta_sh_t* sh, nlist_t* chg, char* line, const unsigned lineno) {
+    // trim trailing whitespace, including a CR
+    size_t len = strlen(line);
+    while(len && (line[len - 1] == ' ' || line[len - 1] == '\t' || line[len - 1] == '\r'))
+        line[--len] = '\0';
+
+    char* p = skip_ws(line);
+    if(!*p || *p == '#')
+        return false;
+
+    const char op = *p++;
+    if((op != '+' && op != '-') || (*p != ' ' && *p != '\t')) {
+        ERR("Delta file '%s', line %u: expected '+', '-', or '#'", sh->fn, lineno);
+        return true;
+    }
+
+    char* net = skip_ws(p);
+    p = skip_token(net);
+    char* key = skip_ws(p);
+    *p = '\0';
+
+    if(!*net) {
+        ERR("Delta file '%s', line %u: no network", sh->fn, lineno);
+        return true;
+    }
+    if(op == '+' && !*key) {
+        ERR("Delta file '%s', line %u: no key for '%s'", sh->fn, lineno, net);
+        return true;
+    }
+    if(op == '-' && *key) {
+        ERR("Delta file '%s', line %u: trailing data after '%s'", sh->fn, lineno, net);
+        return true;
+    }
+    for(const char* k = key; *k; k++) {
+        if((uint8_t)*k < 0x20 || *k == 0x7F) {
+            ERR("Delta file '%s', line %u: control character in key", sh->fn, lineno);
+            return true;
+        }
+    }
+
+    unsigned mask;
+    uint8_t ipv6[16];
+    const char* why = vnm_net_parse(net, ipv6, &mask);
+    if(why) {
+        ERR("Delta file '%s', line %u: '%s' %s", sh->fn, lineno, net, why);
+        return true;
+    }
+
+    const unsigned dclist = op == '+' ? vnm_strdb_add(sh->strdb, key) : NLIST_REMOVED;
+    if(nlist_append(chg, ipv6, mask, dclist))
+        ERR("Delta file '%s', line %u: '%s' has bits beyond the network mask, which were auto-cleared!", sh->fn, lineno, net);
+
+    return false;
+}
+
+// Reads the complete lines added to the delta file since last time into a
+//   new *chg_p, which is left NULL if there were none.  true retval means
+//   error (logged), or a reload if *reload_p was set.
+static bool delta_read(vnm_delta_sh_t* sh, nlist_t** chg_p, bool* reload_p) {
+    *chg_p = NULL;
+
+    FILE* fp = fopen(sh->fn, "r");
+    if(!fp) {
+        if(errno != ENOENT) {
+            ERR("Failed to open delta file '%s': %s", sh->fn, strerror(errno));
+            return true;
+        }
+        // gone, which only matters if something was read from it
+        sh->seen = false;
+        if(sh->off) {
+            *reload_p = true;
+            return true;
+        }
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fileno(fp), &st)) {
+        ERR("Failed to fstat() delta file '%s': %s", sh->fn, strerror(errno));
+        fclose(fp);
+        return true;
+    }
+
+    if(sh->seen && sh->dev == st.st_dev && sh->ino == st.st_ino) {
+        if(st.st_size < sh->off) {
+            fclose(fp);
+            *reload_p = true;
+            return true;
+        }
+        if(st.st_size == sh->tried_size && st.st_mtime == sh->tried_mtime) {
+            fclose(fp);
+            return false;
+        }
+    }
+    else if(sh->off) {
+        // replaced after being read
+        fclose(fp);
+        *reload_p = true;
+        return true;
+    }
+
+    sh->seen = true;
+    sh->dev = st.st_dev;
+    sh->ino = st.st_ino;
+    sh->tried_size = st.st_size;
+    sh->tried_mtime = st.st_mtime;
+
+    if(sh->off && fseeko(fp, sh->off, SEEK_SET)) {
+        ERR("Failed to seek in delta file '%s': %s", sh->fn, strerror(errno));
+        fclose(fp);
+        return true;
+    }
+
+    nlist_t* chg = nlist_new();
+    bool changed = false;
+    bool rv = false;
+    off_t off = sh->off;
+    unsigned lines = sh->lines;
+    char* line = NULL;
+    size_t line_alloc = 0;
+    ssize_t len;
+    while((len = getline(&line, &line_alloc, fp)) > 0) {
+        if(line[len - 1] != '\n')
+            break; // still being written
+        line[len - 1] = '\0';
+        if(strlen(line) != (size_t)(len - 1)) {
+            ERR("Delta file '%s', line %u: NUL byte", sh->fn, lines + 1U);
+            rv = true;
+            break;
+        }
+        const unsigned before = nlist_count(chg);
+        if(delta_line(sh, chg, line, lines + 1U)) {
+            rv = true;
+            break;
+        }
+        changed |= nlist_count(chg) != before;
+        off += len;
+        lines++;
+    }
+    if(!rv && ferror(fp)) {
+        ERR("Failed to read delta file '%s': %s", sh->fn, strerror(errno));
+        rv = true;
+    }
+    free(line);
+    fclose(fp);
+
+    // a bad line fails the whole read, and it's tried again once the file
+    //   changes
+    if(rv || !changed) {
+        nlist_destroy(chg);
+        chg = NULL;
+    }
+    if(!rv) {
+        sh->off = off;
+        sh->lines = lines;
+    }
+    *chg_p = chg;
+    return rv;
+}
+
+// Applies "chg" to the newest version's tree, appending to the store, or
+//   moving to a new and larger one if it runs out of room
+static void delta_apply(vnm_delta_sh_t* sh, nlist_t* chg) {
+    nlist_finish_unmerged(chg, true);
+    nlist_t* ovl = nlist_overlay_merge(sh->ovl, chg);
+
+    ntree_t tree = {
+        .store = sh->st->nodes,
+        .root = sh->root,
+        .count = sh->count,
+        .alloc = sh->st->alloc,
+        .borrowed = true,
+    };
+    unsigned need;
+    while(nlist_xlate_update(sh->base, ovl, chg, &tree, &need)) {
+        tree.alloc = 0;
+        unsigned count;
+        vnm_delta_store_t* st = store_new(&tree, spare_for(tree.count, need), &count);
+        store_unref(sh->st);
+        sh->st = st;
+        tree.store = st->nodes;
+        tree.count = count;
+        tree.alloc = st->alloc;
+        ntree_set_root(&tree, 0);
+    }
+
+    if(sh->ovl)
+        nlist_destroy(sh->ovl);
+    sh->ovl = ovl;
+    sh->root = tree.root;
+    sh->count = tree.count;
+}
+
+// A new version for the newest tree, with its tree and strdb
+static vnm_delta_t* delta_version(vnm_delta_sh_t* sh, ntree_t** tree_p, vnm_strdb_t** strdb_p) {
+    vnm_delta_t* d = malloc(sizeof(vnm_delta_t));
+    d->sh = sh;
+    d->st = sh->st;
+    d->count = sh->count;
+    __atomic_add_fetch(&sh->refs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&sh->st->refs, 1, __ATOMIC_RELAXED);
+
+    ntree_t* tree = malloc(sizeof(ntree_t));
+    tree->store = sh->st->nodes;
+    tree->count = sh->count;
+    tree->alloc = 0;
+    tree->borrowed = true;
+    ntree_set_root(tree, sh->root);
+
+    *tree_p = tree;
+    *strdb_p = vnm_strdb_snapshot(sh->strdb);
+    return d;
+}
+
+static void sh_destroy(vnm_delta_sh_t* sh) {
+    store_unref(sh->st);
+    if(sh->ovl)
+        nlist_destroy(sh->ovl);
+    nlist_destroy(sh->base);
+    vnm_strdb_destroy(sh->strdb);
+    free(sh->fn);
+    free(sh);
+}
+
+vnm_delta_t* vnm_delta_new(const char* fn, nlist_t* base, ntree_t** tree_p, vnm_strdb_t** strdb_p) {
+    assert(fn); assert(base); assert(tree_p); assert(strdb_p);
+
+    ntree_t* tree = *tree_p;
+    assert(!tree->alloc); assert(!tree->root);
+
+    vnm_delta_sh_t* sh = calloc(1, sizeof(vnm_delta_sh_t));
+    const size_t fnlen = strlen(fn);
+    sh->fn = malloc(fnlen + 7);
+    memcpy(sh->fn, fn, fnlen);
+    memcpy(&sh->fn[fnlen], ".delta", 7);
+    sh->base = base;
+    sh->strdb = *strdb_p;
+
+    sh->st = store_new(tree, spare_for(tree->count, 0), &sh->count);
+    sh->root = 0;
+    ntree_destroy(tree);
+    *tree_p = NULL;
+    *strdb_p = NULL;
+
+    nlist_t* chg;
+    bool reload = false;
+    if(delta_read(sh, &chg, &reload)) {
+        sh_destroy(sh);
+        return NULL;
+    }
+    if(chg) {
+        delta_apply(sh, chg);
+        nlist_destroy(chg);
+    }
+
+    return delta_version(sh, tree_p, strdb_p);
+}
+
+vnm_delta_t* vnm_delta_update(vnm_delta_t* d, ntree_t** tree_p, vnm_strdb_t** strdb_p, bool* reload_p) {
+    assert(d); assert(tree_p); assert(strdb_p); assert(reload_p);
+
+    vnm_delta_sh_t* sh = d->sh;
+    assert(d->st == sh->st && d->count == sh->count); // the newest version
+
+    *reload_p = false;
+    nlist_t* chg;
+    if(delta_read(sh, &chg, reload_p) || !chg)
+        return NULL;
+
+    delta_apply(sh, chg);
+    nlist_destroy(chg);
+    return delta_version(sh, tree_p, strdb_p);
+}
+
+void vnm_delta_destroy(vnm_delta_t* d) {
+    assert(d);
+    vnm_delta_sh_t* sh = d->sh;
+    store_unref(d->st);
+    if(!__atomic_sub_fetch(&sh->refs, 1, __ATOMIC_ACQ_REL))
+        sh_destroy(sh);
+    free(d);
+}
@@ -0,0 +1,71 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_DELTA_HDR
+#define VNM_DELTA_HDR
+
+#include "config.h"
+#include <stdbool.h>
+
+#include "vnm_strdb.h"
+#include "ntree.h"
+#include "nlist.h"
+
+// Delta files, for the "delta=on" option: "<database>.delta" is an
+//   append-only log of changes to a JSON, text or MMDB database, one
+//   per line:
+//
+//   + <network> <key>   maps the network to the key, replacing any
+//                       existing entry for exactly that network
+//   - <network>         removes the entry for exactly that network, if any
+//   # ...               comments and blank lines are ignored
+//
+// Networks are parsed as in JSON databases, and the key is the rest of
+//   the line with surrounding whitespace trimmed.  Lines are applied in
+//   order, and only complete (newline-terminated) lines are read, so that
+//   a writer may append while the file is being read.
+//
+// The lookup tree's store is shared between the versions of a database
+//   made from one base load: each version only appends new copies of the
+//   paths its changes touch, and older versions keep using the nodes they
+//   were built with until they're destroyed.
+
+struct _vnm_delta;
+typedef struct _vnm_delta vnm_delta_t;
+
+// Starts delta tracking for the database "fn", given the unmerged list it
+//   was loaded into (see nlist_finish_unmerged()), the finished tree built
+//   from that, and the strdb holding its keys, all of which are taken over.
+//   The delta file is applied as it is now, and *tree_p and *strdb_p are
+//   replaced with a tree and strdb for the result, for the caller to
+//   destroy before the returned version.  NULL retval means error
+//   (logged), with everything freed.
+vnm_delta_t* vnm_delta_new(const char* fn, nlist_t* base, ntree_t** tree_p, vnm_strdb_t** strdb_p);
+
+// Applies any complete lines appended to the delta file since the newest
+//   version "d", returning a new version with its tree and strdb as above.
+//   NULL retval means there was nothing new, or an error (logged), or that
+//   the delta file was replaced, truncated, or removed since it was read,
+//   which sets *reload_p: the database must then be loaded from scratch.
+vnm_delta_t* vnm_delta_update(vnm_delta_t* d, ntree_t** tree_p, vnm_strdb_t** strdb_p, bool* reload_p);
+
+// May be called from any thread, in any order of versions
+void vnm_delta_destroy(vnm_delta_t* d);
+
+#endif // VNM_DELTA_HDR
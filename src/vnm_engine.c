@@ -0,0 +1,267 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_log.h"
+#include "vnm_engine.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ntree.h"
+#include "nptrie.h"
+#include "nrange.h"
+
+/**************************
+ * Engine method wrappers *
+ **************************/
+
+static void* eng_tree_build(ntree_t* tree) { return tree; }
+static void eng_tree_destroy(void* e) { ntree_destroy(e); }
+static size_t eng_tree_size(const void* e) {
+    const ntree_t* tree = e;
+    return sizeof(ntree_t) + (size_t)tree->count * sizeof(nnode_t);
+}
+static unsigned eng_tree_lookup_v4(const void* e, const uint32_t ipv4) { return ntree_lookup_v4(e, ipv4); }
+static unsigned eng_tree_lookup_v6(const void* e, const uint8_t* ipv6) { return ntree_lookup_v6(e, ipv6); }
+static void eng_tree_lookup_batch(const void* e, const unsigned n, const uint8_t* addrs, unsigned* results) { ntree_lookup_batch(e, n, addrs, results); }
+
+static void* eng_poptrie_build(ntree_t* tree) { return nptrie_new(tree); }
+static void eng_poptrie_destroy(void* e) { nptrie_destroy(e); }
+static size_t eng_poptrie_size(const void* e) { return nptrie_size(e); }
+static unsigned eng_poptrie_lookup_v4(const void* e, const uint32_t ipv4) { return nptrie_lookup_v4(e, ipv4); }
+static unsigned eng_poptrie_lookup_v6(const void* e, const uint8_t* ipv6) { return nptrie_lookup_v6(e, ipv6); }
+
+static void* eng_range_build(ntree_t* tree) { return nrange_new(tree); }
+static void eng_range_destroy(void* e) { nrange_destroy(e); }
+static size_t eng_range_size(const void* e) { return nrange_size(e); }
+static unsigned eng_range_lookup_v4(const void* e, const uint32_t ipv4) { return nrange_lookup_v4(e, ipv4); }
+static unsigned eng_range_lookup_v6(const void* e, const uint8_t* ipv6) { return nrange_lookup_v6(e, ipv6); }
+
+const vnm_engine_t vnm_engine_tree = {
+    .name = "tree",
+    .build = eng_tree_build,
+    .destroy = eng_tree_destroy,
+    .size = eng_tree_size,
+    .lookup_v4 = eng_tree_lookup_v4,
+    .lookup_v6 = eng_tree_lookup_v6,
+    .lookup_batch = eng_tree_lookup_batch,
+};
+
+const vnm_engine_t vnm_engine_poptrie = {
+    .name = "poptrie",
+    .build = eng_poptrie_build,
+    .destroy = eng_poptrie_destroy,
+    .size = eng_poptrie_size,
+    .lookup_v4 = eng_poptrie_lookup_v4,
+    .lookup_v6 = eng_poptrie_lookup_v6,
+};
+
+const vnm_engine_t vnm_engine_range = {
+    .name = "range",
+    .build = eng_range_build,
+    .destroy = eng_range_destroy,
+    .size = eng_range_size,
+    .lookup_v4 = eng_range_lookup_v4,
+    .lookup_v6 = eng_range_lookup_v6,
+};
+
+void vnm_engine_lookup_batch(const vnm_engine_t* eng, const void* e, const unsigned n, const uint8_t* addrs, unsigned* results) {
+    if(eng->lookup_batch) {
+        eng->lookup_batch(e, n, addrs, results);
+    }
+    else {
+        for(unsigned i = 0; i < n; i++)
+            results[i] = eng->lookup_v6(e, &addrs[i * 16]);
+    }
+}
+
+const vnm_engine_t* vnm_engine_get(const vnm_engine_id_t id) {
+    const vnm_engine_t* rv;
+    switch(id) {
+        case VNM_ENGINE_POPTRIE: rv = &vnm_engine_poptrie; break;
+        case VNM_ENGINE_RANGE: rv = &vnm_engine_range; break;
+        default: assert(id == VNM_ENGINE_TREE); rv = &vnm_engine_tree; break;
+    }
+    return rv;
+}
+
+/***************
+ * Auto select *
+ ***************/
+
+// Below this many tree nodes the whole tree stays cache-resident, and
+//   there's nothing to gain from building anything else.
+#define AUTO_SMALL_NODES 4096U
+
+// Candidates using more than this multiple of the tree's memory are out
+#define AUTO_MEM_FACTOR 2U
+
+// Among candidates within this factor of the fastest, the smallest wins
+#define AUTO_SPEED_SLACK 1.10
+
+#define PROBE_ADDRS 4096U
+#define PROBE_ROUNDS 3U
+
+typedef struct {
+    uint32_t v4[PROBE_ADDRS];
+    uint8_t v6[PROBE_ADDRS][16];
+    bool is_v4[PROBE_ADDRS];
+} probe_t;
+
+// xorshift64*, fixed seed so selection is repeatable for the same data
+static uint64_t probe_rng(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static unsigned count_leaves(const ntree_t* tree, const uint32_t ref) {
+    if(NN_IS_DCLIST(ref))
+        return 1;
+    assert(ref < tree->count);
+    return count_leaves(tree, tree->store[ref].zero)
+        + count_leaves(tree, tree->store[ref].one);
+}
+
+// Random descent from "ref", preferring interior branches so that the
+//   probe addresses land mostly in the populated parts of the address
+//   space rather than the big default ranges.  "bits" is a uint8_t[16]
+//   in network order, filled from bit "depth" onwards.
+static void probe_descend(const ntree_t* tree, uint32_t ref, unsigned depth, const unsigned maxbits, uint8_t* bits, uint64_t* rng) {
+    while(depth < maxbits) {
+        bool one;
+        if(NN_IS_DCLIST(ref)) {
+            one = probe_rng(rng) & 1;
+        }
+        else {
+            const nnode_t* node = &tree->store[ref];
+            const bool zero_int = !NN_IS_DCLIST(node->zero);
+            const bool one_int = !NN_IS_DCLIST(node->one);
+            if(zero_int != one_int && (probe_rng(rng) & 7))
+                one = one_int;
+            else
+                one = probe_rng(rng) & 1;
+            ref = one ? node->one : node->zero;
+        }
+        if(one)
+            SETBIT_v6(bits, depth);
+        depth++;
+    }
+}
+
+static void probe_init(probe_t* p, const ntree_t* tree) {
+    const unsigned leaves4 = count_leaves(tree, tree->ipv4);
+    const unsigned leaves_all = count_leaves(tree, tree->root);
+    assert(leaves_all >= leaves4);
+
+    // v4 share of the probe follows the v4 share of the data
+    const uint64_t v4_per_1k = (uint64_t)leaves4 * 1000 / leaves_all;
+
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    for(unsigned i = 0; i < PROBE_ADDRS; i++) {
+        uint8_t bits[16];
+        memset(bits, 0, 16);
+        if(probe_rng(&rng) % 1000 < v4_per_1k) {
+            probe_descend(tree, tree->ipv4, 0, 32, bits, &rng);
+            p->v4[i] = ntohl(gdnsd_get_una32(bits));
+            p->is_v4[i] = true;
+        }
+        else {
+            probe_descend(tree, tree->root, 0, 128, bits, &rng);
+            memcpy(p->v6[i], bits, 16);
+            p->is_v4[i] = false;
+        }
+    }
+}
+
+static double probe_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// best-of-N nanoseconds per lookup
+static double probe_run(const probe_t* p, const vnm_engine_t* eng, const void* inst) {
+    double best = 0;
+    volatile unsigned sink = 0;
+    for(unsigned r = 0; r < PROBE_ROUNDS; r++) {
+        unsigned acc = 0;
+        const double start = probe_now();
+        for(unsigned i = 0; i < PROBE_ADDRS; i++)
+            acc += p->is_v4[i]
+                ? eng->lookup_v4(inst, p->v4[i])
+                : eng->lookup_v6(inst, p->v6[i]);
+        const double ns = (probe_now() - start) / PROBE_ADDRS;
+        sink += acc;
+        if(!r || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+const vnm_engine_t* vnm_engine_auto(ntree_t* tree, void** instance) {
+    assert(tree); assert(instance);
+
+    if(tree->count < AUTO_SMALL_NODES) {
+        INFO("auto engine: %u tree nodes, small enough for tree", tree->count);
+        *instance = vnm_engine_tree.build(tree);
+        return &vnm_engine_tree;
+    }
+
+    const vnm_engine_t* cands[] = { &vnm_engine_tree, &vnm_engine_poptrie, &vnm_engine_range };
+    const unsigned ncands = sizeof(cands) / sizeof(cands[0]);
+    void* insts[sizeof(cands) / sizeof(cands[0])];
+    size_t sizes[sizeof(cands) / sizeof(cands[0])];
+    double ns[sizeof(cands) / sizeof(cands[0])];
+
+    probe_t* p = malloc(sizeof(probe_t));
+    probe_init(p, tree);
+
+    const size_t max_size = AUTO_MEM_FACTOR * vnm_engine_tree.size(tree);
+    unsigned best = 0;
+    for(unsigned i = 0; i < ncands; i++) {
+        insts[i] = cands[i]->build(tree);
+        sizes[i] = cands[i]->size(insts[i]);
+        ns[i] = sizes[i] <= max_size ? probe_run(p, cands[i], insts[i]) : 0;
+        if(ns[i] && ns[i] < ns[best])
+            best = i;
+    }
+
+    // prefer the smallest of the roughly-equally fast
+    unsigned pick = best;
+    for(unsigned i = 0; i < ncands; i++)
+        if(ns[i] && ns[i] <= ns[best] * AUTO_SPEED_SLACK && sizes[i] < sizes[pick])
+            pick = i;
+
+    INFO("auto engine: picked %s (tree %.1fns/%zuKiB, poptrie %.1fns/%zuKiB, range %.1fns/%zuKiB)",
+        cands[pick]->name, ns[0], sizes[0] >> 10, ns[1], sizes[1] >> 10, ns[2], sizes[2] >> 10);
+
+    // the tree candidate is the tree itself, which stays with the caller
+    for(unsigned i = 0; i < ncands; i++)
+        if(i != pick && cands[i] != &vnm_engine_tree)
+            cands[i]->destroy(insts[i]);
+
+    free(p);
+    *instance = insts[pick];
+    return cands[pick];
+}
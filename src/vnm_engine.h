@@ -0,0 +1,41 @@
+#ifndef VNM_ENGINE_HDR
+#define VNM_ENGINE_HDR
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "vnm.h"
+#include "ntree.h"
+
+// A lookup engine is any structure that can be built from a finished
+//   ntree_t and answer the same lookups.  Lookup arguments and results
+//   are as for ntree_lookup_v4() and ntree_lookup_v6().
+typedef struct {
+    const char* name;
+    // The tree engine just takes over the tree itself, the others build
+    //   a separate structure and leave the tree to the caller.
+    void* (*build)(ntree_t* tree);
+    void (*destroy)(void* e);
+    size_t (*size)(const void* e);
+    unsigned (*lookup_v4)(const void* e, const uint32_t ipv4);
+    unsigned (*lookup_v6)(const void* e, const uint8_t* ipv6);
+    // Optional, as for ntree_lookup_batch(), see vnm_engine_lookup_batch()
+    void (*lookup_batch)(const void* e, const unsigned n, const uint8_t* addrs, unsigned* results);
+} vnm_engine_t;
+
+extern const vnm_engine_t vnm_engine_tree;
+extern const vnm_engine_t vnm_engine_poptrie;
+extern const vnm_engine_t vnm_engine_range;
+
+// Uses the engine's lookup_batch() if it has one, else lookup_v6() on each
+void vnm_engine_lookup_batch(const vnm_engine_t* eng, const void* e, const unsigned n, const uint8_t* addrs, unsigned* results);
+
+// Not valid for VNM_ENGINE_AUTO
+const vnm_engine_t* vnm_engine_get(const vnm_engine_id_t id);
+
+// Builds the candidate engines for the tree and picks one, based on the
+//   tree size, its v4/v6 mix, the memory footprint of each candidate, and
+//   a short timing probe of lookups against each.  The chosen engine's
+//   built instance is returned via *instance, and the others are freed.
+const vnm_engine_t* vnm_engine_auto(ntree_t* tree, void** instance);
+
+#endif // VNM_ENGINE_HDR
@@ -0,0 +1,356 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_log.h"
+#include "vnm_json.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define VJ_BUFSIZE 65536U
+
+typedef struct {
+    char* data;
+    unsigned len; // not including the NUL
+    unsigned alloc;
+} vj_str_t;
+
+typedef struct {
+    const char* fn;
+    FILE* fp;
+    unsigned pos;
+    unsigned len;
+    unsigned line; // for error messages
+    bool read_err;
+    vj_str_t key;
+    vj_str_t str;
+    uint8_t buf[VJ_BUFSIZE];
+} vj_t;
+
+static void vj_err(const vj_t* vj, const char* fmt, ...) {
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    ERR("JSON database %s, line %u: %s", vj->fn, vj->line, msg);
+}
+
+// -1 at EOF or on a read error (which is logged)
+static int vj_peek(vj_t* vj) {
+    if(vj->pos == vj->len) {
+        vj->pos = 0;
+        vj->len = fread(vj->buf, 1, VJ_BUFSIZE, vj->fp);
+        if(!vj->len) {
+            if(ferror(vj->fp) && !vj->read_err) {
+                vj_err(vj, "read error: %s", strerror(errno));
+                vj->read_err = true;
+            }
+            return -1;
+        }
+    }
+    return vj->buf[vj->pos];
+}
+
+static int vj_next(vj_t* vj) {
+    const int c = vj_peek(vj);
+    if(c >= 0) {
+        vj->pos++;
+        if(c == '\n')
+            vj->line++;
+    }
+    return c;
+}
+
+static int vj_skip_ws(vj_t* vj) {
+    int c = vj_peek(vj);
+    while(c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        vj_next(vj);
+        c = vj_peek(vj);
+    }
+    return c;
+}
+
+static void vj_str_add(vj_str_t* s, const char c) {
+    if(s->len + 1 >= s->alloc) {
+        s->alloc = s->alloc ? s->alloc << 1 : 64;
+        s->data = realloc(s->data, s->alloc);
+    }
+    s->data[s->len++] = c;
+}
+
+static void vj_str_add_utf8(vj_str_t* s, const uint32_t cp) {
+    if(cp < 0x80) {
+        vj_str_add(s, cp);
+    }
+    else if(cp < 0x800) {
+        vj_str_add(s, 0xC0 | (cp >> 6));
+        vj_str_add(s, 0x80 | (cp & 0x3F));
+    }
+    else if(cp < 0x10000) {
+        vj_str_add(s, 0xE0 | (cp >> 12));
+        vj_str_add(s, 0x80 | ((cp >> 6) & 0x3F));
+        vj_str_add(s, 0x80 | (cp & 0x3F));
+    }
+    else {
+        vj_str_add(s, 0xF0 | (cp >> 18));
+        vj_str_add(s, 0x80 | ((cp >> 12) & 0x3F));
+        vj_str_add(s, 0x80 | ((cp >> 6) & 0x3F));
+        vj_str_add(s, 0x80 | (cp & 0x3F));
+    }
+}
+
+// The four hex digits of a \u escape, -1 on error
+static int32_t vj_hex4(vj_t* vj) {
+    int32_t rv = 0;
+    for(unsigned i = 0; i < 4; i++) {
+        const int c = vj_next(vj);
+        rv <<= 4;
+        if(c >= '0' && c <= '9')
+            rv |= c - '0';
+        else if(c >= 'a' && c <= 'f')
+            rv |= c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')
+            rv |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return rv;
+}
+
+// Copies one multi-byte UTF-8 sequence whose lead byte "c" was already
+//   read, rejecting overlongs, surrogates, and anything past U+10FFFF.
+//   true retval means error.
+static bool vj_utf8(vj_t* vj, vj_str_t* s, const int c) {
+    unsigned more;
+    int lo = 0x80, hi = 0xBF; // range for the first continuation byte
+    if(c >= 0xC2 && c <= 0xDF) {
+        more = 1;
+    }
+    else if(c >= 0xE0 && c <= 0xEF) {
+        more = 2;
+        if(c == 0xE0)
+            lo = 0xA0;
+        else if(c == 0xED)
+            hi = 0x9F;
+    }
+    else if(c >= 0xF0 && c <= 0xF4) {
+        more = 3;
+        if(c == 0xF0)
+            lo = 0x90;
+        else if(c == 0xF4)
+            hi = 0x8F;
+    }
+    else {
+        return true;
+    }
+
+    vj_str_add(s, c);
+    for(unsigned i = 0; i < more; i++) {
+        const int cc = vj_next(vj);
+        if(cc < lo || cc > hi)
+            return true;
+        vj_str_add(s, cc);
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return false;
+}
+
+// Reads a string into "s", after its opening quote.  true retval means
+//   error (logged).
+static bool vj_string(vj_t* vj, vj_str_t* s) {
+    s->len = 0;
+    while(1) {
+        const int c = vj_next(vj);
+        if(c < 0) {
+            vj_err(vj, "unterminated string");
+            return true;
+        }
+        if(c == '"')
+            break;
+        if(c < 0x20) {
+            vj_err(vj, "control character in string");
+            return true;
+        }
+        if(c >= 0x80) {
+            if(vj_utf8(vj, s, c)) {
+                vj_err(vj, "invalid UTF-8 in string");
+                return true;
+            }
+            continue;
+        }
+        if(c != '\\') {
+            vj_str_add(s, c);
+            continue;
+        }
+
+        const int e = vj_next(vj);
+        switch(e) {
+            case '"': case '\\': case '/': vj_str_add(s, e); break;
+            case 'b': vj_str_add(s, '\b'); break;
+            case 'f': vj_str_add(s, '\f'); break;
+            case 'n': vj_str_add(s, '\n'); break;
+            case 'r': vj_str_add(s, '\r'); break;
+            case 't': vj_str_add(s, '\t'); break;
+            case 'u': {
+                int32_t cp = vj_hex4(vj);
+                if(cp >= 0xD800 && cp <= 0xDBFF) {
+                    // must be followed by the low half
+                    int32_t low = -1;
+                    if(vj_next(vj) == '\\' && vj_next(vj) == 'u')
+                        low = vj_hex4(vj);
+                    if(low < 0xDC00 || low > 0xDFFF)
+                        cp = -1;
+                    else
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                else if(cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = -1;
+                }
+                if(cp <= 0) {
+                    vj_err(vj, "invalid or NUL \\u escape in string");
+                    return true;
+                }
+                vj_str_add_utf8(s, cp);
+                break;
+            }
+            default:
+                vj_err(vj, "invalid escape in string");
+                return true;
+        }
+    }
+
+    vj_str_add(s, '\0');
+    s->len--;
+    return false;
+}
+
+// The body of the top-level object, after its opening brace
+static bool vj_object(vj_t* vj, vnm_json_key_cb_t key_cb, vnm_json_str_cb_t str_cb, void* data) {
+    if(vj_skip_ws(vj) == '}') {
+        vj_next(vj);
+        return false;
+    }
+
+    while(1) {
+        if(vj_next(vj) != '"') {
+            vj_err(vj, "expected an object key string");
+            return true;
+        }
+        if(vj_string(vj, &vj->key))
+            return true;
+        if(vj_skip_ws(vj) != ':') {
+            vj_err(vj, "expected ':' after key '%s'", vj->key.data);
+            return true;
+        }
+        vj_next(vj);
+        if(vj_skip_ws(vj) != '[') {
+            vj_err(vj, "value for key '%s' should be an array!", vj->key.data);
+            return true;
+        }
+        vj_next(vj);
+        if(key_cb(data, vj->key.data))
+            return true;
+
+        int c = vj_skip_ws(vj);
+        if(c == ']') {
+            vj_next(vj);
+        }
+        else {
+            for(unsigned idx = 0; ; idx++) {
+                if(vj_next(vj) != '"') {
+                    vj_err(vj, "array member %u for key '%s' should be an address string!", idx, vj->key.data);
+                    return true;
+                }
+                if(vj_string(vj, &vj->str) || str_cb(data, vj->key.data, vj->str.data))
+                    return true;
+                c = vj_skip_ws(vj);
+                vj_next(vj);
+                if(c == ']')
+                    break;
+                if(c != ',') {
+                    vj_err(vj, "expected ',' or ']' in the array for key '%s'", vj->key.data);
+                    return true;
+                }
+                vj_skip_ws(vj);
+            }
+        }
+
+        c = vj_skip_ws(vj);
+        vj_next(vj);
+        if(c == '}')
+            break;
+        if(c != ',') {
+            vj_err(vj, "expected ',' or '}' after the array for key '%s'", vj->key.data);
+            return true;
+        }
+        vj_skip_ws(vj);
+    }
+
+    return false;
+}
+
+bool vnm_json_stream(const char* fn, vnm_json_key_cb_t key_cb, vnm_json_str_cb_t str_cb, void* data) {
+    assert(fn); assert(key_cb); assert(str_cb);
+
+    FILE* fp = fopen(fn, "r");
+    if(!fp) {
+        ERR("Failed to open JSON database %s: %s", fn, strerror(errno));
+        return true;
+    }
+
+    vj_t* vj = calloc(1, sizeof(vj_t));
+    vj->fn = fn;
+    vj->fp = fp;
+    vj->line = 1;
+
+    bool rv;
+    const int c = vj_skip_ws(vj);
+    vj_next(vj);
+    if(c == '{') {
+        rv = vj_object(vj, key_cb, str_cb, data);
+    }
+    else if(c == '[' && vj_skip_ws(vj) == ']') {
+        vj_next(vj);
+        rv = false;
+    }
+    else {
+        vj_err(vj, "top-level is not an object or empty array!");
+        rv = true;
+    }
+
+    if(!rv && vj_skip_ws(vj) >= 0) {
+        vj_err(vj, "trailing data after the top-level value");
+        rv = true;
+    }
+    if(vj->read_err)
+        rv = true;
+
+    free(vj->key.data);
+    free(vj->str.data);
+    free(vj);
+    fclose(fp);
+    return rv;
+}
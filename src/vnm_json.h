@@ -0,0 +1,43 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_JSON_HDR
+#define VNM_JSON_HDR
+
+#include "config.h"
+#include <stdbool.h>
+
+// A streaming reader for the JSON database format, a top-level object
+//   of arrays of strings (or an empty top-level array), which hands each
+//   key and array member to the callbacks as it is tokenized rather than
+//   building a document in memory.  Memory use is a fixed read buffer
+//   plus the longest single string.  Any other JSON, or anything that
+//   isn't JSON, is an error.  Strings must be valid UTF-8 without NULs,
+//   with escapes decoded.
+
+// Called for each key before its array's members, and for each member
+//   with the key it belongs to.  The strings are only valid during the
+//   call.  A true retval aborts the parse (and the callback logs why).
+typedef bool (*vnm_json_key_cb_t)(void* data, const char* key);
+typedef bool (*vnm_json_str_cb_t)(void* data, const char* key, const char* str);
+
+// true retval means error (logged)
+bool vnm_json_stream(const char* fn, vnm_json_key_cb_t key_cb, vnm_json_str_cb_t str_cb, void* data);
+
+#endif // VNM_JSON_HDR
@@ -0,0 +1,17 @@
+#ifndef VNM_LOG_HDR
+#define VNM_LOG_HDR
+
+// Logging for the shared vnm code, which is built both into the vmod and
+//   into the standalone vnm_validate tool (with NO_VARNISH).
+
+#ifdef NO_VARNISH
+#include <stdio.h>
+#define ERR(fmt,...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#define INFO(fmt,...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#else
+#include "cache/cache.h"
+#define ERR(fmt,...) VSL(SLT_Error, 0, "vmod_netmapper: " fmt, ##__VA_ARGS__)
+#define INFO(fmt,...) VSL(SLT_CLI, 0, "vmod_netmapper: " fmt, ##__VA_ARGS__) // CLI??
+#endif
+
+#endif // VNM_LOG_HDR
@@ -0,0 +1,582 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "vnm_log.h"
+#include "vnm_mmdb.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "vnm_addr.h"
+
+static const uint8_t mm_marker[] = "\xAB\xCD\xEFMaxMind.com";
+#define MM_MARKER_LEN (sizeof(mm_marker) - 1U)
+
+// The metadata must start within this distance of the end of the file
+#define MM_METADATA_MAX (128U * 1024U)
+
+// Maps and arrays nest no deeper than this in any sane record
+#define MM_NEST_MAX 32U
+
+// Longest usable key value, including the NUL
+#define MM_KEYVAL_MAX 1024U
+
+// Data field types
+#define MM_PTR 1U
+#define MM_STR 2U
+#define MM_DOUBLE 3U
+#define MM_BYTES 4U
+#define MM_U16 5U
+#define MM_U32 6U
+#define MM_MAP 7U
+#define MM_I32 8U
+#define MM_U64 9U
+#define MM_U128 10U
+#define MM_ARRAY 11U
+#define MM_CONTAINER 12U
+#define MM_END 13U
+#define MM_BOOL 14U
+#define MM_FLOAT 15U
+
+// A data section (or the metadata), which pointers are relative to
+typedef struct {
+    const uint8_t* p;
+    size_t len;
+} mm_sec_t;
+
+// Reads the type and size of the field at *off, and moves *off to its
+//   payload.  For pointers, *size_p is the target offset instead.  true
+//   retval means it runs off the end or isn't valid.
+static bool mm_head(const mm_sec_t* s, size_t* off, unsigned* type_p, uint32_t* size_p) {
+    if(*off >= s->len)
+        return true;
+    const uint8_t ctrl = s->p[(*off)++];
+    unsigned type = ctrl >> 5;
+
+    if(type == MM_PTR) {
+        const unsigned ss = (ctrl >> 3) & 3U;
+        if(s->len - *off < ss + 1U)
+            return true;
+        const uint8_t* b = &s->p[*off];
+        const uint32_t vvv = ctrl & 7U;
+        uint32_t v;
+        if(ss == 0)
+            v = (vvv << 8) | b[0];
+        else if(ss == 1)
+            v = ((vvv << 16) | ((uint32_t)b[0] << 8) | b[1]) + 2048U;
+        else if(ss == 2)
+            v = ((vvv << 24) | ((uint32_t)b[0] << 16) | ((uint32_t)b[1] << 8) | b[2]) + 526336U;
+        else
+            v = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+        *off += ss + 1U;
+        *type_p = MM_PTR;
+        *size_p = v;
+        return false;
+    }
+
+    if(!type) {
+        if(*off >= s->len)
+            return true;
+        type = 7U + s->p[(*off)++];
+        if(type < 8U || type > MM_FLOAT)
+            return true;
+    }
+
+    uint32_t size = ctrl & 0x1FU;
+    if(size >= 29U) {
+        const unsigned n = size - 28U;
+        if(s->len - *off < n)
+            return true;
+        uint32_t x = 0;
+        for(unsigned i = 0; i < n; i++)
+            x = (x << 8) | s->p[(*off)++];
+        size = n == 1U ? 29U + x : n == 2U ? 285U + x : 65821U + x;
+    }
+
+    *type_p = type;
+    *size_p = size;
+    return false;
+}
+
+// The same, but following a pointer to what it points at
+static bool mm_resolve(const mm_sec_t* s, size_t* off, unsigned* type_p, uint32_t* size_p) {
+    if(mm_head(s, off, type_p, size_p))
+        return true;
+    if(*type_p == MM_PTR) {
+        *off = *size_p;
+        // pointers to pointers aren't allowed
+        if(mm_head(s, off, type_p, size_p) || *type_p == MM_PTR)
+            return true;
+    }
+    return false;
+}
+
+// Moves *off past the field there (just the pointer, for a pointer)
+static bool mm_skip(const mm_sec_t* s, size_t* off, const unsigned depth) {
+    if(depth > MM_NEST_MAX)
+        return true;
+
+    unsigned type;
+    uint32_t size;
+    if(mm_head(s, off, &type, &size))
+        return true;
+
+    switch(type) {
+        case MM_PTR:
+        case MM_BOOL: // the value is in the size
+            return false;
+        case MM_MAP:
+            for(uint32_t i = 0; i < size; i++)
+                if(mm_skip(s, off, depth + 1U) || mm_skip(s, off, depth + 1U))
+                    return true;
+            return false;
+        case MM_ARRAY:
+            for(uint32_t i = 0; i < size; i++)
+                if(mm_skip(s, off, depth + 1U))
+                    return true;
+            return false;
+        case MM_CONTAINER:
+        case MM_END:
+            return true;
+        default:
+            if(s->len - *off < size)
+                return true;
+            *off += size;
+            return false;
+    }
+}
+
+// Finds the field at the dot-separated "path" within the value at "off",
+//   leaving *off at its payload.  true retval means the data is invalid,
+//   and otherwise *found_p says whether the path exists.
+static bool mm_lookup(const mm_sec_t* s, size_t* off, const char* path, unsigned* type_p, uint32_t* size_p, bool* found_p) {
+    *found_p = false;
+
+    for(unsigned depth = 0; ; depth++) {
+        if(depth > MM_NEST_MAX || mm_resolve(s, off, type_p, size_p))
+            return true;
+        if(!*path) {
+            *found_p = true;
+            return false;
+        }
+
+        const char* dot = strchr(path, '.');
+        const size_t clen = dot ? (size_t)(dot - path) : strlen(path);
+
+        if(*type_p == MM_MAP) {
+            bool matched = false;
+            for(uint32_t i = 0; i < *size_p && !matched; i++) {
+                size_t koff = *off;
+                unsigned ktype;
+                uint32_t ksize;
+                if(mm_resolve(s, &koff, &ktype, &ksize) || ktype != MM_STR || s->len - koff < ksize)
+                    return true;
+                matched = ksize == clen && !memcmp(&s->p[koff], path, clen);
+                if(mm_skip(s, off, depth + 1U))
+                    return true;
+                if(!matched && mm_skip(s, off, depth + 1U))
+                    return true;
+            }
+            if(!matched)
+                return false;
+        }
+        else if(*type_p == MM_ARRAY) {
+            char* endptr = NULL;
+            const unsigned long idx = strtoul(path, &endptr, 10);
+            if(endptr != path + clen || idx >= *size_p)
+                return false;
+            for(unsigned long i = 0; i < idx; i++)
+                if(mm_skip(s, off, depth + 1U))
+                    return true;
+        }
+        else {
+            return false;
+        }
+
+        path += clen;
+        if(*path)
+            path++;
+    }
+}
+
+// An unsigned integer payload of "size" big-endian bytes
+static bool mm_uint(const mm_sec_t* s, const size_t off, const uint32_t size, const unsigned max, uint64_t* v_p) {
+    if(size > max || s->len - off < size)
+        return true;
+    uint64_t v = 0;
+    for(uint32_t i = 0; i < size; i++)
+        v = (v << 8) | s->p[off + i];
+    *v_p = v;
+    return false;
+}
+
+// The field at "path" in the map at "off" as an unsigned integer
+static bool mm_lookup_uint(const mm_sec_t* s, size_t off, const char* path, uint64_t* v_p) {
+    unsigned type;
+    uint32_t size;
+    bool found;
+    if(mm_lookup(s, &off, path, &type, &size, &found) || !found)
+        return true;
+    if(type != MM_U16 && type != MM_U32 && type != MM_U64)
+        return true;
+    return mm_uint(s, off, size, type == MM_U16 ? 2U : type == MM_U32 ? 4U : 8U, v_p);
+}
+
+// Formats the key field of the record at "off" into "buf" (MM_KEYVAL_MAX
+//   bytes).  true retval means the data is invalid, and otherwise
+//   *found_p says whether the record has a usable key.
+static bool mm_key(const mm_sec_t* s, size_t off, const char* path, char* buf, bool* found_p) {
+    unsigned type;
+    uint32_t size;
+    if(mm_lookup(s, &off, path, &type, &size, found_p))
+        return true;
+    if(!*found_p)
+        return false;
+
+    *found_p = false;
+    uint64_t v;
+    switch(type) {
+        case MM_STR:
+            if(s->len - off < size)
+                return true;
+            if(size >= MM_KEYVAL_MAX || memchr(&s->p[off], 0, size))
+                return false;
+            memcpy(buf, &s->p[off], size);
+            buf[size] = '\0';
+            break;
+        case MM_U16:
+        case MM_U32:
+        case MM_U64:
+            if(mm_uint(s, off, size, type == MM_U16 ? 2U : type == MM_U32 ? 4U : 8U, &v))
+                return true;
+            snprintf(buf, MM_KEYVAL_MAX, "%" PRIu64, v);
+            break;
+        case MM_I32:
+            if(mm_uint(s, off, size, 4U, &v))
+                return true;
+            // only a full 4 bytes can be negative
+            snprintf(buf, MM_KEYVAL_MAX, "%" PRId32, size == 4U ? (int32_t)(uint32_t)v : (int32_t)v);
+            break;
+        case MM_BOOL:
+            if(size > 1U)
+                return true;
+            strcpy(buf, size ? "true" : "false");
+            break;
+        default:
+            return false;
+    }
+
+    *found_p = *buf != '\0';
+    return false;
+}
+
+// Data record offset -> strdb index (zero for no usable key), as many
+//   networks share each record
+typedef struct {
+    uint32_t off_plus1; // zero for empty
+    unsigned idx;
+} mm_cache_slot_t;
+
+typedef struct {
+    mm_cache_slot_t* slots;
+    unsigned mask;
+    unsigned count;
+} mm_cache_t;
+
+static mm_cache_slot_t* mm_cache_find(mm_cache_t* c, const uint32_t off) {
+    unsigned i = (off * 2654435761U) & c->mask;
+    while(c->slots[i].off_plus1 && c->slots[i].off_plus1 != off + 1U)
+        i = (i + 1U) & c->mask;
+    return &c->slots[i];
+}
+
+static void mm_cache_grow(mm_cache_t* c) {
+    mm_cache_slot_t* old = c->slots;
+    const unsigned old_size = c->mask + 1U;
+    c->mask = (old_size << 1) - 1U;
+    c->slots = calloc(c->mask + 1U, sizeof(mm_cache_slot_t));
+    for(unsigned i = 0; i < old_size; i++)
+        if(old[i].off_plus1)
+            *mm_cache_find(c, old[i].off_plus1 - 1U) = old[i];
+    free(old);
+}
+
+// One tree node still to walk, and the network it's at
+typedef struct {
+    uint32_t node;
+    unsigned depth;
+    uint8_t addr[16];
+} mm_walk_t;
+
+typedef struct {
+    const char* fn;
+    const char* key_path;
+    const uint8_t* tree;
+    uint32_t node_count;
+    unsigned record_size;
+    unsigned base_bit; // 96 for IPv4 trees, which go in v4compat
+    unsigned max_depth;
+    mm_sec_t data;
+    vnm_strdb_t* strdb;
+    nlist_t* nl;
+    mm_cache_t cache;
+    unsigned keyed;
+} mm_load_t;
+
+static void mm_node(const mm_load_t* ml, const uint32_t node, uint32_t* rec) {
+    const uint8_t* b = &ml->tree[(size_t)node * ml->record_size / 4U];
+    if(ml->record_size == 24U) {
+        rec[0] = ((uint32_t)b[0] << 16) | ((uint32_t)b[1] << 8) | b[2];
+        rec[1] = ((uint32_t)b[3] << 16) | ((uint32_t)b[4] << 8) | b[5];
+    }
+    else if(ml->record_size == 28U) {
+        rec[0] = ((uint32_t)(b[3] & 0xF0U) << 20) | ((uint32_t)b[0] << 16) | ((uint32_t)b[1] << 8) | b[2];
+        rec[1] = ((uint32_t)(b[3] & 0x0FU) << 24) | ((uint32_t)b[4] << 16) | ((uint32_t)b[5] << 8) | b[6];
+    }
+    else {
+        rec[0] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+        rec[1] = ((uint32_t)b[4] << 24) | ((uint32_t)b[5] << 16) | ((uint32_t)b[6] << 8) | b[7];
+    }
+}
+
+// The strdb index for the data record a tree record points at
+static bool mm_record_key(mm_load_t* ml, const uint32_t rec, unsigned* idx_p) {
+    const uint64_t off = (uint64_t)rec - ml->node_count - 16U;
+    if(rec < ml->node_count + 16U || off >= ml->data.len) {
+        ERR("MMDB database '%s' has a bad data pointer in its search tree", ml->fn);
+        return true;
+    }
+
+    mm_cache_slot_t* slot = mm_cache_find(&ml->cache, (uint32_t)off);
+    if(!slot->off_plus1) {
+        char buf[MM_KEYVAL_MAX];
+        bool found;
+        if(mm_key(&ml->data, (size_t)off, ml->key_path, buf, &found)) {
+            ERR("MMDB database '%s' has an invalid data record at offset %" PRIu64, ml->fn, off);
+            return true;
+        }
+        slot->off_plus1 = (uint32_t)off + 1U;
+        slot->idx = found ? vnm_strdb_add(ml->strdb, buf) : 0;
+        if(++ml->cache.count << 1 > ml->cache.mask + 1U) {
+            mm_cache_grow(&ml->cache);
+            slot = mm_cache_find(&ml->cache, (uint32_t)off);
+        }
+    }
+
+    *idx_p = slot->idx;
+    return false;
+}
+
+// Depth-first, with one pending sibling at most per level.  A valid tree
+//   (aliases aside, which aren't followed) visits each node at most once,
+//   so any more visits than nodes means a loop.
+static bool mm_walk(mm_load_t* ml) {
+    mm_walk_t stack[130];
+    unsigned sp = 0;
+    uint64_t visits = 0;
+
+    memset(&stack[0], 0, sizeof(mm_walk_t));
+    sp = 1;
+
+    while(sp) {
+        const mm_walk_t w = stack[--sp];
+        if(++visits > ml->node_count || w.depth >= ml->max_depth) {
+            ERR("MMDB database '%s' has a malformed search tree", ml->fn);
+            return true;
+        }
+
+        uint32_t rec[2];
+        mm_node(ml, w.node, rec);
+        const unsigned bit = ml->base_bit + w.depth;
+        const unsigned mask = bit + 1U;
+
+        for(unsigned side = 0; side < 2; side++) {
+            mm_walk_t c = w;
+            c.depth++;
+            if(side)
+                c.addr[bit >> 3] |= (uint8_t)(0x80U >> (bit & 7U));
+
+            // the IPv4 aliases, or anything else in those spaces
+            if(!ml->base_bit && vnm_net_v4like(c.addr, mask))
+                continue;
+
+            if(rec[side] < ml->node_count) {
+                if(sp == sizeof(stack) / sizeof(stack[0])) {
+                    ERR("MMDB database '%s' has a malformed search tree", ml->fn);
+                    return true;
+                }
+                c.node = rec[side];
+                stack[sp++] = c;
+            }
+            else if(rec[side] > ml->node_count) {
+                unsigned idx;
+                if(mm_record_key(ml, rec[side], &idx))
+                    return true;
+                if(idx) {
+                    nlist_append(ml->nl, c.addr, mask, idx);
+                    ml->keyed++;
+                }
+            }
+            // and equal to node_count means no data
+        }
+    }
+
+    return false;
+}
+
+bool vnm_mmdb_detect(const char* fn) {
+    assert(fn);
+
+    bool rv = false;
+    const int fd = open(fn, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(!fstat(fd, &st) && st.st_size >= (off_t)MM_MARKER_LEN) {
+        const size_t tail = st.st_size < (off_t)MM_METADATA_MAX ? (size_t)st.st_size : MM_METADATA_MAX;
+        uint8_t* buf = malloc(tail);
+        if(pread(fd, buf, tail, st.st_size - (off_t)tail) == (ssize_t)tail)
+            rv = memmem(buf, tail, mm_marker, MM_MARKER_LEN) != NULL;
+        free(buf);
+    }
+    close(fd);
+    return rv;
+}
+
+// The start of the metadata, after the last marker in the file's tail
+static const uint8_t* mm_find_metadata(const uint8_t* base, const size_t len) {
+    const size_t tail = len < MM_METADATA_MAX ? len : MM_METADATA_MAX;
+    const uint8_t* found = NULL;
+    const uint8_t* p = base + len - tail;
+    const uint8_t* end = base + len;
+    while((p = memmem(p, (size_t)(end - p), mm_marker, MM_MARKER_LEN))) {
+        found = p + MM_MARKER_LEN;
+        p = found;
+    }
+    return found;
+}
+
+bool vnm_mmdb_load(const char* fn, const char* key_path, vnm_strdb_t* strdb, nlist_t* nl) {
+    assert(fn); assert(key_path); assert(strdb); assert(nl);
+
+    if(!*key_path) {
+        ERR("MMDB database '%s' needs the mmdb_key option to name its key field", fn);
+        return true;
+    }
+
+    const int fd = open(fn, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        ERR("Failed to open MMDB database '%s': %s", fn, strerror(errno));
+        return true;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st)) {
+        ERR("Failed to fstat() MMDB database '%s': %s", fn, strerror(errno));
+        close(fd);
+        return true;
+    }
+
+    const size_t len = (size_t)st.st_size;
+    void* map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED) {
+        ERR("Failed to mmap() MMDB database '%s': %s", fn, len ? strerror(errno) : "empty file");
+        return true;
+    }
+    const uint8_t* base = map;
+
+    const char* fail = NULL;
+    mm_load_t ml = {
+        .fn = fn,
+        .key_path = key_path,
+        .strdb = strdb,
+        .nl = nl,
+    };
+
+    // metadata: the tree's shape
+    const uint8_t* meta = mm_find_metadata(base, len);
+    uint64_t node_count = 0, record_size = 0, ip_version = 0, major = 0;
+    if(!meta) {
+        fail = "no metadata";
+    }
+    else {
+        const mm_sec_t ms = { .p = meta, .len = (size_t)(base + len - meta) };
+        if(mm_lookup_uint(&ms, 0, "binary_format_major_version", &major)
+            || mm_lookup_uint(&ms, 0, "node_count", &node_count)
+            || mm_lookup_uint(&ms, 0, "record_size", &record_size)
+            || mm_lookup_uint(&ms, 0, "ip_version", &ip_version))
+            fail = "bad metadata";
+        else if(major != 2U)
+            fail = "unsupported binary format version";
+        else if(record_size != 24U && record_size != 28U && record_size != 32U)
+            fail = "unsupported record size";
+        else if(ip_version != 4U && ip_version != 6U)
+            fail = "bad ip_version";
+        else if(!node_count || node_count >= (1ULL << record_size) - 16U)
+            fail = "bad node_count";
+    }
+
+    // and the sections
+    if(!fail) {
+        const uint64_t tree_len = node_count * record_size / 4U;
+        const size_t meta_off = (size_t)(meta - base) - MM_MARKER_LEN;
+        if(tree_len + 16U > meta_off) {
+            fail = "truncated search tree";
+        }
+        else {
+            ml.tree = base;
+            ml.node_count = (uint32_t)node_count;
+            ml.record_size = (unsigned)record_size;
+            ml.base_bit = ip_version == 4U ? 96U : 0;
+            ml.max_depth = ip_version == 4U ? 32U : 128U;
+            ml.data.p = base + tree_len + 16U;
+            ml.data.len = meta_off - (size_t)tree_len - 16U;
+        }
+    }
+
+    if(fail) {
+        ERR("MMDB database '%s' is invalid: %s", fn, fail);
+        munmap(map, len);
+        return true;
+    }
+
+    ml.cache.mask = 1023U;
+    ml.cache.slots = calloc(ml.cache.mask + 1U, sizeof(mm_cache_slot_t));
+    bool rv = mm_walk(&ml);
+    if(!rv && !ml.keyed) {
+        ERR("MMDB database '%s' has no networks with a usable '%s' field", fn, key_path);
+        rv = true;
+    }
+
+    free(ml.cache.slots);
+    munmap(map, len);
+    return rv;
+}
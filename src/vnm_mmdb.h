@@ -0,0 +1,54 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_MMDB_HDR
+#define VNM_MMDB_HDR
+
+#include "config.h"
+#include <stdbool.h>
+
+#include "vnm_strdb.h"
+#include "nlist.h"
+
+// MaxMind DB (MMDB) files as a database source, read with an in-tree
+//   reader of the published format (binary format 2.x, 24, 28 or 32 bit
+//   records, IPv4 or IPv6 trees).  Rather than looking anything up in the
+//   file at runtime, the loader walks its whole search tree once, and
+//   appends each network with data straight to an nlist, keyed by one
+//   field of its data record, just as a JSON database's networks would be.
+//   Networks whose record lacks the field are left out (no match), and so
+//   are the IPv6 aliases of the IPv4 subtree (::ffff:0:0/96, 2001::/32,
+//   2002::/16), which lookups translate anyway.
+
+// The longest key field path, including the NUL
+#define VNM_MMDB_KEY_MAX 128U
+
+// Whether "fn" has the MMDB metadata marker near its end
+bool vnm_mmdb_detect(const char* fn);
+
+// Appends all the networks of the MMDB file "fn" to "nl", keyed by the
+//   field at "key_path" in their data records, which is a dot-separated
+//   path of map keys and array indices (e.g. "country.iso_code", or
+//   "subdivisions.0.iso_code").  String fields are used as is, integer
+//   and boolean fields in decimal or as "true"/"false", and anything else
+//   is treated as absent.  It's an error for no network at all to have
+//   the field.  true retval means error (logged).
+bool vnm_mmdb_load(const char* fn, const char* key_path, vnm_strdb_t* strdb, nlist_t* nl);
+
+#endif // VNM_MMDB_HDR
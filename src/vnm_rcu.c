@@ -0,0 +1,273 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "config.h"
+#include "vnm_rcu.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#if defined(VNM_RCU_QSBR) || defined(VNM_RCU_MEMB)
+
+const char* vnm_rcu_scheme(void) {
+#ifdef VNM_RCU_QSBR
+    return "qsbr";
+#else
+    return "memb";
+#endif
+}
+
+void vnm_rcu_register_thread(void) {
+    rcu_register_thread();
+}
+
+void vnm_rcu_unregister_thread(void) {
+    rcu_unregister_thread();
+}
+
+void vnm_rcu_synchronize(vnm_rcu_t* r) {
+    (void)r;
+    synchronize_rcu();
+}
+
+#elif defined(VNM_RCU_EPOCH)
+
+// Starts at one, so that a zero "active" always means quiescent
+uint64_t vnm_rcu_epoch = 1;
+__thread vnm_rcu_slot_t* vnm_rcu_self = NULL;
+
+// Slots of exited threads are re-used rather than freed, so the updater
+//   can walk the list under the mutex without worrying about them.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static vnm_rcu_slot_t* registry = NULL;
+
+const char* vnm_rcu_scheme(void) {
+    return "epoch";
+}
+
+void vnm_rcu_register_thread(void) {
+    assert(!vnm_rcu_self);
+    pthread_mutex_lock(&registry_lock);
+    vnm_rcu_slot_t* slot = registry;
+    while(slot && slot->in_use)
+        slot = slot->next;
+    if(!slot) {
+        void* mem = NULL;
+        if(posix_memalign(&mem, 64, sizeof(vnm_rcu_slot_t)))
+            abort();
+        slot = mem;
+        slot->active = 0;
+        slot->next = registry;
+        registry = slot;
+    }
+    slot->in_use = 1;
+    pthread_mutex_unlock(&registry_lock);
+    vnm_rcu_self = slot;
+}
+
+void vnm_rcu_unregister_thread(void) {
+    assert(vnm_rcu_self);
+    assert(!vnm_rcu_self->active);
+    pthread_mutex_lock(&registry_lock);
+    vnm_rcu_self->in_use = 0;
+    pthread_mutex_unlock(&registry_lock);
+    vnm_rcu_self = NULL;
+}
+
+// A reader which entered at an epoch older than the new one may have
+//   loaded the old pointer.  One which entered at the new epoch loaded it
+//   after the increment, which is after the pointer store.
+void vnm_rcu_synchronize(vnm_rcu_t* r) {
+    (void)r;
+    const uint64_t e = __atomic_add_fetch(&vnm_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&registry_lock);
+    for(vnm_rcu_slot_t* slot = registry; slot; slot = slot->next) {
+        if(!slot->in_use)
+            continue;
+        while(1) {
+            const uint64_t a = __atomic_load_n(&slot->active, __ATOMIC_SEQ_CST);
+            if(!a || a >= e)
+                break;
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+#elif defined(VNM_RCU_REFCOUNT)
+
+const char* vnm_rcu_scheme(void) {
+    return "refcount";
+}
+
+void vnm_rcu_register_thread(void) { }
+void vnm_rcu_unregister_thread(void) { }
+
+// Flip the counter pair and drain the old side, twice: a reader can load
+//   the index, stall, and count itself on the old side after the first
+//   drain.  It can only have loaded the new pointer then, but it is
+//   still holding it into the next update, which the second flip and
+//   drain covers, as it leaves the index where the next update's first
+//   drain will look.
+void vnm_rcu_synchronize(vnm_rcu_t* r) {
+    for(unsigned pass = 0; pass < 2; pass++) {
+        const unsigned old = __atomic_load_n(&r->idx, __ATOMIC_RELAXED) & 1U;
+        __atomic_store_n(&r->idx, old ^ 1U, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&r->readers[old], __ATOMIC_SEQ_CST))
+            sched_yield();
+    }
+}
+
+#endif
+
+// Deferred reclamation, the same for every scheme
+
+typedef struct vnm_rcu_deferred {
+    struct vnm_rcu_deferred* next;
+    vnm_rcu_t* r;
+    void (*fn)(void*);
+    void* arg;
+} vnm_rcu_deferred_t;
+
+static pthread_mutex_t defer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t defer_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t defer_done_cond = PTHREAD_COND_INITIALIZER;
+static vnm_rcu_deferred_t* defer_head = NULL;
+static vnm_rcu_deferred_t** defer_tail = &defer_head;
+static bool defer_running = false;
+static bool defer_stopping = false;
+static pthread_t defer_thread;
+static vnm_rcu_stats_t defer_stats;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000U + (uint64_t)ts.tv_nsec / 1000U;
+}
+
+// Takes the whole queue at a time, waits out one grace period for it
+//   (one per distinct "r" for refcount, whose grace periods are per
+//   pointer), and then runs its callbacks
+static void* defer_main(void* unused) {
+    (void)unused;
+    pthread_setname_np(pthread_self(), "netmap-rcu");
+
+    pthread_mutex_lock(&defer_lock);
+    while(1) {
+        while(!defer_head && !defer_stopping)
+            pthread_cond_wait(&defer_work_cond, &defer_lock);
+        if(!defer_head)
+            break;
+
+        vnm_rcu_deferred_t* batch = defer_head;
+        defer_head = NULL;
+        defer_tail = &defer_head;
+        pthread_mutex_unlock(&defer_lock);
+
+        const uint64_t start = now_us();
+#ifdef VNM_RCU_REFCOUNT
+        for(vnm_rcu_deferred_t* d = batch; d; d = d->next) {
+            bool seen = false;
+            for(vnm_rcu_deferred_t* e = batch; e != d; e = e->next)
+                if(e->r == d->r)
+                    seen = true;
+            if(!seen)
+                vnm_rcu_synchronize(d->r);
+        }
+#else
+        vnm_rcu_synchronize(batch->r);
+#endif
+        const uint64_t grace_us = now_us() - start;
+
+        uint64_t count = 0;
+        while(batch) {
+            vnm_rcu_deferred_t* next = batch->next;
+            batch->fn(batch->arg);
+            free(batch);
+            batch = next;
+            count++;
+        }
+
+        pthread_mutex_lock(&defer_lock);
+        defer_stats.pending -= count;
+        defer_stats.retired += count;
+        defer_stats.grace_periods++;
+        defer_stats.grace_us_last = grace_us;
+        defer_stats.grace_us_total += grace_us;
+        if(grace_us > defer_stats.grace_us_max)
+            defer_stats.grace_us_max = grace_us;
+        pthread_cond_broadcast(&defer_done_cond);
+    }
+    pthread_mutex_unlock(&defer_lock);
+    return NULL;
+}
+
+void vnm_rcu_defer(vnm_rcu_t* r, void (*fn)(void*), void* arg) {
+    assert(r); assert(fn);
+
+    vnm_rcu_deferred_t* d = malloc(sizeof(vnm_rcu_deferred_t));
+    if(!d)
+        abort();
+    d->next = NULL;
+    d->r = r;
+    d->fn = fn;
+    d->arg = arg;
+
+    pthread_mutex_lock(&defer_lock);
+    while(defer_stopping || defer_stats.pending >= VNM_RCU_DEFER_MAX)
+        pthread_cond_wait(&defer_done_cond, &defer_lock);
+    if(!defer_running) {
+        if(pthread_create(&defer_thread, NULL, defer_main, NULL))
+            abort();
+        defer_running = true;
+    }
+    *defer_tail = d;
+    defer_tail = &d->next;
+    defer_stats.pending++;
+    pthread_cond_signal(&defer_work_cond);
+    pthread_mutex_unlock(&defer_lock);
+}
+
+void vnm_rcu_barrier(void) {
+    pthread_mutex_lock(&defer_lock);
+    while(defer_stopping || defer_stats.pending)
+        pthread_cond_wait(&defer_done_cond, &defer_lock);
+    if(defer_running) {
+        defer_stopping = true;
+        pthread_cond_signal(&defer_work_cond);
+        pthread_mutex_unlock(&defer_lock);
+        pthread_join(defer_thread, NULL);
+        pthread_mutex_lock(&defer_lock);
+        defer_running = false;
+        defer_stopping = false;
+        pthread_cond_broadcast(&defer_done_cond);
+    }
+    pthread_mutex_unlock(&defer_lock);
+}
+
+void vnm_rcu_stats(vnm_rcu_stats_t* stats) {
+    pthread_mutex_lock(&defer_lock);
+    *stats = defer_stats;
+    pthread_mutex_unlock(&defer_lock);
+}
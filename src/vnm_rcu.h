@@ -0,0 +1,202 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_RCU_H
+#define VNM_RCU_H
+
+#include "config.h"
+
+// Reclamation of replaced databases, chosen at build time with
+//   configure --with-rcu=SCHEME:
+//
+// qsbr:     liburcu-qsbr (the default).  Readers are nearly free inside
+//           the critical section, but as Varnish gives us no quiescent
+//           state hook, every read side goes online and offline, which
+//           costs a full barrier each way.
+// memb:     liburcu's memb flavor.  A read side is a counter update
+//           plus a compiler barrier, with sys_membarrier() on the
+//           updater side where the kernel has it.
+// epoch:    in-tree.  Each reader thread publishes the global epoch it
+//           entered at in its own cache line (one seq_cst store), and
+//           the updater bumps the epoch and waits out any thread still
+//           in an older one.
+// refcount: in-tree.  Readers count themselves in one of two shared
+//           per-database counters, and the updater flips the pair and
+//           waits for the old side to drain before freeing.  No thread
+//           registry at all, but every reader hits the same cache line.
+//
+// vnm_bench's "readers" section measures whichever is compiled in, across
+//   reader thread counts.
+
+#if !defined(VNM_RCU_MEMB) && !defined(VNM_RCU_EPOCH) && !defined(VNM_RCU_REFCOUNT)
+#  define VNM_RCU_QSBR 1
+#endif
+
+#include <inttypes.h>
+#include <string.h>
+
+// Per-protected-pointer state, only used by refcount
+typedef struct {
+#ifdef VNM_RCU_REFCOUNT
+    unsigned idx;
+    unsigned long readers[2];
+#else
+    char unused;
+#endif
+} vnm_rcu_t;
+
+static inline void vnm_rcu_init(vnm_rcu_t* r) {
+    memset(r, 0, sizeof(vnm_rcu_t));
+}
+
+// Name of the compiled-in scheme, for logging and vnm_bench
+const char* vnm_rcu_scheme(void);
+
+// Call once on each reader thread before its first vnm_rcu_read_lock(),
+//   and unregister before the thread exits.  Updater threads which only
+//   call vnm_rcu_synchronize() don't register.
+void vnm_rcu_register_thread(void);
+void vnm_rcu_unregister_thread(void);
+
+// Waits until no reader can still see the pointer replaced by a
+//   preceding vnm_rcu_assign_pointer() on "r"'s pointer.
+void vnm_rcu_synchronize(vnm_rcu_t* r);
+
+// Deferred reclamation: queues "fn(arg)" to run on a reclaimer thread
+//   once no reader can still see the pointer replaced by a preceding
+//   vnm_rcu_assign_pointer() on "r"'s pointer, rather than the caller
+//   waiting out the grace period itself.  One grace period covers every
+//   callback queued before it began.  With VNM_RCU_DEFER_MAX callbacks
+//   already pending, this blocks until the reclaimer catches up, which
+//   bounds the memory held by retired copies.  "r" must stay valid until
+//   the callback has run.
+#define VNM_RCU_DEFER_MAX 4U
+void vnm_rcu_defer(vnm_rcu_t* r, void (*fn)(void*), void* arg);
+
+// Waits until every callback deferred so far has run, and stops the
+//   reclaimer thread until the next vnm_rcu_defer()
+void vnm_rcu_barrier(void);
+
+// Process-wide deferred reclamation counters, grace periods in usec
+typedef struct {
+    uint64_t pending;
+    uint64_t retired;
+    uint64_t grace_periods;
+    uint64_t grace_us_last;
+    uint64_t grace_us_max;
+    uint64_t grace_us_total;
+} vnm_rcu_stats_t;
+
+void vnm_rcu_stats(vnm_rcu_stats_t* stats);
+
+// Read side: the value returned by read_lock goes back to read_unlock.
+//   Read sections don't nest.
+
+#if defined(VNM_RCU_QSBR)
+
+// inline read side fast paths
+#define _LGPL_SOURCE 1
+#include <urcu-qsbr.h>
+
+static inline unsigned vnm_rcu_read_lock(vnm_rcu_t* r) {
+    (void)r;
+    rcu_thread_online();
+    rcu_read_lock();
+    return 0;
+}
+
+static inline void vnm_rcu_read_unlock(vnm_rcu_t* r, const unsigned t) {
+    (void)r; (void)t;
+    rcu_read_unlock();
+    rcu_thread_offline();
+}
+
+#define vnm_rcu_dereference(p) rcu_dereference(p)
+#define vnm_rcu_assign_pointer(p, v) rcu_assign_pointer(p, v)
+
+#elif defined(VNM_RCU_MEMB)
+
+// inline read side fast paths
+#define _LGPL_SOURCE 1
+#include <urcu.h>
+
+static inline unsigned vnm_rcu_read_lock(vnm_rcu_t* r) {
+    (void)r;
+    rcu_read_lock();
+    return 0;
+}
+
+static inline void vnm_rcu_read_unlock(vnm_rcu_t* r, const unsigned t) {
+    (void)r; (void)t;
+    rcu_read_unlock();
+}
+
+#define vnm_rcu_dereference(p) rcu_dereference(p)
+#define vnm_rcu_assign_pointer(p, v) rcu_assign_pointer(p, v)
+
+#else // epoch and refcount
+
+// Both rely on the updater's pointer store and its epoch or counter
+//   update being totally ordered against the readers' own, so these are
+//   seq_cst (plain loads on x86).
+#define vnm_rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#define vnm_rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+
+#if defined(VNM_RCU_EPOCH)
+
+// One per registered thread, a cache line each.  "active" is the epoch
+//   the thread's current read section started in, or zero outside of one.
+typedef struct vnm_rcu_slot {
+    uint64_t active;
+    struct vnm_rcu_slot* next;
+    unsigned in_use; // protected by the registry mutex
+} __attribute__((aligned(64))) vnm_rcu_slot_t;
+
+extern uint64_t vnm_rcu_epoch;
+extern __thread vnm_rcu_slot_t* vnm_rcu_self;
+
+static inline unsigned vnm_rcu_read_lock(vnm_rcu_t* r) {
+    (void)r;
+    const uint64_t e = __atomic_load_n(&vnm_rcu_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&vnm_rcu_self->active, e, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static inline void vnm_rcu_read_unlock(vnm_rcu_t* r, const unsigned t) {
+    (void)r; (void)t;
+    __atomic_store_n(&vnm_rcu_self->active, 0, __ATOMIC_RELEASE);
+}
+
+#elif defined(VNM_RCU_REFCOUNT)
+
+static inline unsigned vnm_rcu_read_lock(vnm_rcu_t* r) {
+    const unsigned t = __atomic_load_n(&r->idx, __ATOMIC_RELAXED) & 1U;
+    __atomic_add_fetch(&r->readers[t], 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static inline void vnm_rcu_read_unlock(vnm_rcu_t* r, const unsigned t) {
+    __atomic_sub_fetch(&r->readers[t], 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+#endif
+
+#endif // VNM_RCU_H
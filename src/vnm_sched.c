@@ -0,0 +1,542 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "vnm_log.h"
+#include "vnm_sched.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+// Wheel resolution and size: one revolution is 12.8s, and jobs due later
+//   than that just stay in their slot until it comes around at the right
+//   time.
+#define VNM_SCHED_TICK_MS 50U
+#define VNM_SCHED_SLOTS 256U
+#define VNM_SCHED_SLOT_MASK (VNM_SCHED_SLOTS - 1U)
+
+// Threads running jobs
+#define VNM_SCHED_WORKERS 2U
+
+// A change has settled once there have been no events for this long...
+#define VNM_SCHED_QUIET_MS 200U
+// ... or at the latest this long after it began
+#define VNM_SCHED_SETTLE_MAX_MS 2000U
+
+// Periodic runs are put off by up to 1/8 of their delay, up to this much
+#define VNM_SCHED_JITTER_MAX_MS 5000U
+
+typedef enum {
+    JOB_WAITING = 0, // on the wheel
+    JOB_QUEUED,      // on the run queue
+    JOB_RUNNING,     // on a worker
+} job_state_t;
+
+struct _vnm_sched_job {
+    vnm_sched_cb_t cb;
+    void* data;
+    vnm_watch_t* watch;
+    vnm_sched_job_t* next_all;
+    vnm_sched_job_t* next; // in a wheel slot or the run queue
+    vnm_sched_job_t** pprev; // in a wheel slot
+    uint64_t deadline; // tick, while waiting
+    uint64_t settle_end; // tick, while waiting for a change to settle, else 0
+    job_state_t state;
+    bool again; // changed while queued or running
+    bool removed;
+    bool changed; // while reading inotify events
+};
+
+// One of a job's inotify watch descriptors.  Jobs watching the same
+//   directory or file share its descriptor, which is only removed from
+//   inotify once no job uses it.
+typedef struct {
+    int wd;
+    vnm_sched_job_t* job;
+} sched_wd_t;
+
+// Serializes add/remove, and with them starting and stopping the threads
+static pthread_mutex_t sched_life_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Everything else below
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sched_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sched_done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+    bool running;
+    bool stop;
+    unsigned njobs;
+    vnm_sched_job_t* jobs;
+    vnm_sched_job_t* wheel[VNM_SCHED_SLOTS];
+    vnm_sched_job_t* runq;
+    vnm_sched_job_t** runq_tail;
+    uint64_t epoch_ms; // tick 0
+    uint64_t tick; // every slot up to here has been processed
+    uint64_t rand_state;
+    int wake[2]; // pipe to interrupt the scheduler's poll
+    int ino_fd; // the one inotify instance for all watches, -1 for none
+    sched_wd_t* wds; // descriptor -> job, unordered
+    unsigned nwds;
+    unsigned wds_alloc;
+    pthread_t thread;
+    pthread_t workers[VNM_SCHED_WORKERS];
+} sched;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U;
+}
+
+static uint64_t now_tick(void) {
+    return (now_ms() - sched.epoch_ms) / VNM_SCHED_TICK_MS;
+}
+
+// Rounded up, so a job never runs early
+static uint64_t ms_to_ticks(const unsigned ms) {
+    return ((uint64_t)ms + VNM_SCHED_TICK_MS - 1U) / VNM_SCHED_TICK_MS;
+}
+
+// xorshift64, only for jitter
+static uint64_t sched_rand(void) {
+    uint64_t x = sched.rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sched.rand_state = x;
+    return x;
+}
+
+static uint64_t jitter_ticks(const unsigned ms) {
+    unsigned max_ms = ms >> 3;
+    if(max_ms > VNM_SCHED_JITTER_MAX_MS)
+        max_ms = VNM_SCHED_JITTER_MAX_MS;
+    const uint64_t max_ticks = max_ms / VNM_SCHED_TICK_MS;
+    return max_ticks ? sched_rand() % (max_ticks + 1U) : 0;
+}
+
+static void sched_wake(void) {
+    const char c = 0;
+    // a full pipe already means a pending wakeup
+    if(write(sched.wake[1], &c, 1) < 0 && errno != EAGAIN)
+        ERR("Reload scheduler wakeup failed: %s", strerror(errno));
+}
+
+static void wheel_insert(vnm_sched_job_t* job, uint64_t deadline) {
+    if(deadline <= sched.tick)
+        deadline = sched.tick + 1U;
+    job->deadline = deadline;
+    job->state = JOB_WAITING;
+    vnm_sched_job_t** slot = &sched.wheel[deadline & VNM_SCHED_SLOT_MASK];
+    job->next = *slot;
+    if(job->next)
+        job->next->pprev = &job->next;
+    job->pprev = slot;
+    *slot = job;
+}
+
+static void wheel_unlink(vnm_sched_job_t* job) {
+    assert(job->state == JOB_WAITING);
+    *job->pprev = job->next;
+    if(job->next)
+        job->next->pprev = job->pprev;
+}
+
+static void runq_push(vnm_sched_job_t* job) {
+    job->state = JOB_QUEUED;
+    job->next = NULL;
+    *sched.runq_tail = job;
+    sched.runq_tail = &job->next;
+    pthread_cond_signal(&sched_work_cond);
+}
+
+static void runq_unlink(vnm_sched_job_t* job) {
+    vnm_sched_job_t** link = &sched.runq;
+    while(*link != job)
+        link = &(*link)->next;
+    *link = job->next;
+    if(sched.runq_tail == &job->next)
+        sched.runq_tail = link;
+}
+
+// Removes "wd" from inotify, unless some job still uses it
+static void wd_release(const int wd) {
+    for(unsigned i = 0; i < sched.nwds; i++)
+        if(sched.wds[i].wd == wd)
+            return;
+#ifdef HAVE_SYS_INOTIFY_H
+    inotify_rm_watch(sched.ino_fd, wd);
+#endif
+}
+
+static bool wd_listed(const int wd, const int* wds, const unsigned n) {
+    for(unsigned i = 0; i < n; i++)
+        if(wds[i] == wd)
+            return true;
+    return false;
+}
+
+// Makes "wds" the job's descriptors in the map, removing any it dropped
+//   from inotify unless another job still uses them
+static void job_wds_set(vnm_sched_job_t* job, const int* wds, const unsigned n) {
+    for(unsigned i = 0; i < sched.nwds; ) {
+        if(sched.wds[i].job == job && !wd_listed(sched.wds[i].wd, wds, n)) {
+            const int wd = sched.wds[i].wd;
+            sched.wds[i] = sched.wds[--sched.nwds];
+            wd_release(wd);
+        }
+        else {
+            i++;
+        }
+    }
+
+    for(unsigned k = 0; k < n; k++) {
+        bool found = false;
+        for(unsigned i = 0; !found && i < sched.nwds; i++)
+            found = sched.wds[i].job == job && sched.wds[i].wd == wds[k];
+        if(found)
+            continue;
+        if(sched.nwds == sched.wds_alloc) {
+            sched.wds_alloc = sched.wds_alloc ? sched.wds_alloc << 1 : 16U;
+            sched.wds = realloc(sched.wds, sched.wds_alloc * sizeof(sched_wd_t));
+        }
+        sched.wds[sched.nwds].wd = wds[k];
+        sched.wds[sched.nwds].job = job;
+        sched.nwds++;
+    }
+}
+
+// (Re-)adds whichever of the job's watches aren't in place, e.g. on a
+//   file that was missing or has been replaced
+static void job_arm(vnm_sched_job_t* job) {
+    if(!job->watch || sched.ino_fd < 0)
+        return;
+    vnm_watch_arm(job->watch, sched.ino_fd);
+    int wds[VNM_WATCH_WDS];
+    job_wds_set(job, wds, vnm_watch_wds(job->watch, wds));
+}
+
+// A watch saw changes: run the job once they've settled
+static void job_changed(vnm_sched_job_t* job, const uint64_t now) {
+    if(job->state != JOB_WAITING) {
+        job->again = true;
+        return;
+    }
+    if(!job->settle_end)
+        job->settle_end = now + ms_to_ticks(VNM_SCHED_SETTLE_MAX_MS);
+    uint64_t deadline = now + ms_to_ticks(VNM_SCHED_QUIET_MS);
+    if(deadline > job->settle_end)
+        deadline = job->settle_end;
+    wheel_unlink(job);
+    wheel_insert(job, deadline);
+}
+
+// Queues everything that has come due, up to tick "now"
+static void wheel_advance(const uint64_t now) {
+    uint64_t t = sched.tick + 1U;
+    // more than a revolution behind, each slot only needs one look
+    if(now - sched.tick > VNM_SCHED_SLOTS)
+        t = now - VNM_SCHED_SLOTS + 1U;
+    for(; t <= now; t++) {
+        vnm_sched_job_t* job = sched.wheel[t & VNM_SCHED_SLOT_MASK];
+        while(job) {
+            vnm_sched_job_t* next = job->next;
+            if(job->deadline <= now) {
+                wheel_unlink(job);
+                job->settle_end = 0;
+                runq_push(job);
+            }
+            job = next;
+        }
+    }
+    if(now > sched.tick)
+        sched.tick = now;
+}
+
+// Drains the inotify instance, and schedules a run of every job that any
+//   of the events were about
+static void sched_read_events(const uint64_t now) {
+#ifdef HAVE_SYS_INOTIFY_H
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while((len = read(sched.ino_fd, buf, sizeof(buf))) > 0) {
+        for(char* p = buf; p < buf + len; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            // the lost events could have been about anything
+            if(ev->mask & IN_Q_OVERFLOW) {
+                for(vnm_sched_job_t* job = sched.jobs; job; job = job->next_all)
+                    if(job->watch)
+                        job->changed = true;
+                continue;
+            }
+
+            for(unsigned i = 0; i < sched.nwds; i++) {
+                vnm_sched_job_t* job = sched.wds[i].job;
+                if(sched.wds[i].wd == ev->wd && vnm_watch_event(job->watch, ev->wd, ev->mask, ev->len ? ev->name : NULL))
+                    job->changed = true;
+            }
+
+            // gone from inotify already, and no longer any job's
+            if(ev->mask & IN_IGNORED) {
+                for(unsigned i = 0; i < sched.nwds; ) {
+                    if(sched.wds[i].wd == ev->wd)
+                        sched.wds[i] = sched.wds[--sched.nwds];
+                    else
+                        i++;
+                }
+            }
+        }
+    }
+#endif
+
+    for(vnm_sched_job_t* job = sched.jobs; job; job = job->next_all) {
+        if(job->changed) {
+            job->changed = false;
+            job_arm(job);
+            job_changed(job, now);
+        }
+    }
+}
+
+// Until the next non-empty slot's tick, or -1 for none
+static int wheel_timeout(void) {
+    for(uint64_t k = 1U; k <= VNM_SCHED_SLOTS; k++) {
+        if(sched.wheel[(sched.tick + k) & VNM_SCHED_SLOT_MASK]) {
+            const uint64_t at = sched.epoch_ms + (sched.tick + k) * VNM_SCHED_TICK_MS;
+            const uint64_t now = now_ms();
+            return at > now ? (int)(at - now) : 0;
+        }
+    }
+    return -1;
+}
+
+static void* sched_main(void* unused __attribute__((unused))) {
+    pthread_setname_np(pthread_self(), "netmap");
+
+    struct pollfd pfds[2] = {
+        { .fd = sched.wake[0], .events = POLLIN },
+        { .fd = sched.ino_fd, .events = POLLIN },
+    };
+    const nfds_t npfds = sched.ino_fd >= 0 ? 2U : 1U;
+
+    pthread_mutex_lock(&sched_lock);
+    while(!sched.stop) {
+        pfds[0].revents = pfds[1].revents = 0;
+        const int timeout = wheel_timeout();
+
+        pthread_mutex_unlock(&sched_lock);
+        poll(pfds, npfds, timeout);
+        pthread_mutex_lock(&sched_lock);
+
+        if(pfds[0].revents) {
+            char buf[64];
+            while(read(sched.wake[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        const uint64_t now = now_tick();
+        if(pfds[1].revents)
+            sched_read_events(now);
+        wheel_advance(now);
+    }
+    pthread_mutex_unlock(&sched_lock);
+
+    return NULL;
+}
+
+static void* worker_main(void* unused __attribute__((unused))) {
+    pthread_setname_np(pthread_self(), "netmap-run");
+
+    pthread_mutex_lock(&sched_lock);
+    while(1) {
+        while(!sched.stop && !sched.runq)
+            pthread_cond_wait(&sched_work_cond, &sched_lock);
+        if(sched.stop)
+            break;
+
+        vnm_sched_job_t* job = sched.runq;
+        runq_unlink(job);
+        job->state = JOB_RUNNING;
+        job->again = false;
+
+        pthread_mutex_unlock(&sched_lock);
+        const unsigned delay_ms = job->cb(job->data);
+        pthread_mutex_lock(&sched_lock);
+
+        if(!job->removed) {
+            // also picks up e.g. a directory that didn't exist before
+            job_arm(job);
+            const uint64_t now = now_tick();
+            uint64_t deadline = now + ms_to_ticks(delay_ms) + jitter_ticks(delay_ms);
+            if(job->again) {
+                // changed during the run, which may have missed it
+                const uint64_t soon = now + ms_to_ticks(VNM_SCHED_QUIET_MS);
+                if(soon < deadline)
+                    deadline = soon;
+            }
+            wheel_insert(job, deadline);
+            sched_wake();
+        }
+        else {
+            job->state = JOB_WAITING;
+        }
+        pthread_cond_broadcast(&sched_done_cond);
+    }
+    pthread_mutex_unlock(&sched_lock);
+    return NULL;
+}
+
+static void sched_start(void) {
+    if(pipe2(sched.wake, O_NONBLOCK | O_CLOEXEC)) {
+        ERR("Reload scheduler pipe failed: %s", strerror(errno));
+        abort();
+    }
+#ifdef HAVE_SYS_INOTIFY_H
+    sched.ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(sched.ino_fd < 0)
+        ERR("Failed to set up inotify for database reloads, falling back to polling: %s", strerror(errno));
+#else
+    sched.ino_fd = -1;
+#endif
+    sched.stop = false;
+    sched.runq = NULL;
+    sched.runq_tail = &sched.runq;
+    sched.epoch_ms = now_ms();
+    sched.tick = 0;
+    sched.rand_state = sched.epoch_ms ^ ((uint64_t)getpid() << 32) ^ 0x9E3779B97F4A7C15ULL;
+    if(!sched.rand_state)
+        sched.rand_state = 1U;
+    pthread_create(&sched.thread, NULL, sched_main, NULL);
+    for(unsigned i = 0; i < VNM_SCHED_WORKERS; i++)
+        pthread_create(&sched.workers[i], NULL, worker_main, NULL);
+    sched.running = true;
+}
+
+static void sched_stop(void) {
+    pthread_mutex_lock(&sched_lock);
+    sched.stop = true;
+    pthread_cond_broadcast(&sched_work_cond);
+    sched_wake();
+    pthread_mutex_unlock(&sched_lock);
+
+    pthread_join(sched.thread, NULL);
+    for(unsigned i = 0; i < VNM_SCHED_WORKERS; i++)
+        pthread_join(sched.workers[i], NULL);
+    close(sched.wake[0]);
+    close(sched.wake[1]);
+    if(sched.ino_fd >= 0)
+        close(sched.ino_fd);
+    // every job's descriptors are gone with their jobs
+    assert(!sched.nwds);
+    free(sched.wds);
+    sched.wds = NULL;
+    sched.wds_alloc = 0;
+    sched.running = false;
+}
+
+vnm_sched_job_t* vnm_sched_add(vnm_sched_cb_t cb, void* data, vnm_watch_t* watch, const unsigned first_ms) {
+    assert(cb);
+
+    vnm_sched_job_t* job = calloc(1, sizeof(vnm_sched_job_t));
+    job->cb = cb;
+    job->data = data;
+    job->watch = watch;
+
+    pthread_mutex_lock(&sched_life_lock);
+    if(!sched.running)
+        sched_start();
+
+    pthread_mutex_lock(&sched_lock);
+    job->next_all = sched.jobs;
+    sched.jobs = job;
+    sched.njobs++;
+    // before returning, so that no change after that is missed
+    job_arm(job);
+    wheel_insert(job, now_tick() + ms_to_ticks(first_ms) + jitter_ticks(first_ms));
+    sched_wake();
+    pthread_mutex_unlock(&sched_lock);
+
+    pthread_mutex_unlock(&sched_life_lock);
+    return job;
+}
+
+void vnm_sched_hurry(vnm_sched_job_t* job, const unsigned ms) {
+    assert(job);
+
+    pthread_mutex_lock(&sched_lock);
+    const uint64_t deadline = now_tick() + ms_to_ticks(ms);
+    if(job->state == JOB_WAITING && deadline < job->deadline) {
+        wheel_unlink(job);
+        wheel_insert(job, deadline);
+        sched_wake();
+    }
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void vnm_sched_remove(vnm_sched_job_t* job) {
+    assert(job);
+
+    pthread_mutex_lock(&sched_life_lock);
+    pthread_mutex_lock(&sched_lock);
+
+    vnm_sched_job_t** link = &sched.jobs;
+    while(*link != job)
+        link = &(*link)->next_all;
+    *link = job->next_all;
+    sched.njobs--;
+
+    job->removed = true;
+    if(job->state == JOB_WAITING)
+        wheel_unlink(job);
+    else if(job->state == JOB_QUEUED)
+        runq_unlink(job);
+
+    // events are only matched to jobs through the map, under sched_lock
+    job_wds_set(job, NULL, 0);
+
+    // wait for a run to finish
+    while(job->state == JOB_RUNNING)
+        pthread_cond_wait(&sched_done_cond, &sched_lock);
+
+    const bool last = !sched.njobs;
+    pthread_mutex_unlock(&sched_lock);
+
+    if(last)
+        sched_stop();
+    pthread_mutex_unlock(&sched_life_lock);
+
+    free(job);
+}
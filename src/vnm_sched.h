@@ -0,0 +1,60 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_SCHED_HDR
+#define VNM_SCHED_HDR
+
+#include "config.h"
+#include <stdbool.h>
+
+#include "vnm_watch.h"
+
+// The process-wide reload scheduler.  One thread keeps every registered
+//   job on a hashed timer wheel and reads all of their watches' events
+//   from one shared inotify instance (a wd-to-job map routes them), and a
+//   small fixed pool of threads runs the jobs that come due, so no more
+//   than a couple of reloads ever run at once.  Periodic runs are jittered
+//   so that jobs with the same interval drift apart rather than all firing
+//   together, and a watch event runs its job once the changes have been
+//   quiet for a short while (or have kept going for a while longer), so
+//   that a burst of writes gives one run at its end.  The threads exist
+//   only while there are jobs.
+
+struct _vnm_sched_job;
+typedef struct _vnm_sched_job vnm_sched_job_t;
+
+// Runs on a pool thread, never concurrently with itself.  Returns the
+//   delay in ms until it should run again, absent watch events.
+typedef unsigned (*vnm_sched_cb_t)(void* data);
+
+// Registers a job to first run after "first_ms", and whenever "watch"
+//   (which may be NULL) sees changes.  The watch is armed before this
+//   returns, so changes after that are never missed.  "watch" must
+//   outlive the job.
+vnm_sched_job_t* vnm_sched_add(vnm_sched_cb_t cb, void* data, vnm_watch_t* watch, const unsigned first_ms);
+
+// Makes sure the job's next run is no more than "ms" away
+void vnm_sched_hurry(vnm_sched_job_t* job, const unsigned ms);
+
+// Unregisters and frees the job, waiting out a run in progress, so that
+//   the callback is never called again once this returns.  The last job
+//   out stops the threads.
+void vnm_sched_remove(vnm_sched_job_t* job);
+
+#endif // VNM_SCHED_HDR
@@ -25,50 +25,209 @@
 
 #include "vnm_strdb.h"
 
+// Initial and largest size of the chunks strings go in while adding
+#define VNM_STRDB_CHUNK_MIN 4096U
+#define VNM_STRDB_CHUNK_MAX (1U << 20)
+
+// An intern table slot, with the string's hash so that probes and growth
+//   rarely have to look at the string itself
+typedef struct {
+    unsigned hash;
+    unsigned idx; // zero for empty
+} vnm_strdb_slot_t;
+
+typedef struct vnm_strdb_chunk {
+    struct vnm_strdb_chunk* next;
+    size_t size;
+    size_t used;
+    char data[];
+} vnm_strdb_chunk_t;
+
 struct _vnm_strdb {
-    vnm_str_t* strings;
+    vnm_str_t* strings; // finished: the start of the one allocation
     unsigned count;
-    unsigned alloc;
+    unsigned alloc; // zero unless strings can still be added
+    bool borrowed;
+    // while adding
+    vnm_strdb_chunk_t* chunks; // newest first
+    vnm_strdb_slot_t* index; // open addressing by hash
+    unsigned index_mask;
+    // once finished or borrowed
+    const char* arena;
+    size_t arena_len;
 };
 
+// FNV-1a
+static unsigned str_hash(const char* str) {
+    unsigned h = 2166136261U;
+    while(*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static void index_insert(vnm_strdb_t* d, const unsigned hash, const unsigned idx) {
+    unsigned i = hash & d->index_mask;
+    while(d->index[i].idx)
+        i = (i + 1U) & d->index_mask;
+    d->index[i].hash = hash;
+    d->index[i].idx = idx;
+}
+
+// Kept at a load factor of at most 1/2, like the string table's alloc
+static void index_grow(vnm_strdb_t* d) {
+    const vnm_strdb_slot_t* old = d->index;
+    const unsigned old_size = old ? d->index_mask + 1U : 0;
+    d->index_mask = (d->alloc << 1) - 1U;
+    d->index = calloc(d->index_mask + 1U, sizeof(vnm_strdb_slot_t));
+    for(unsigned i = 0; i < old_size; i++)
+        if(old[i].idx)
+            index_insert(d, old[i].hash, old[i].idx);
+    free((void*)old);
+}
+
+static char* chunk_alloc(vnm_strdb_t* d, const size_t len) {
+    vnm_strdb_chunk_t* c = d->chunks;
+    if(!c || c->size - c->used < len) {
+        size_t size = c ? c->size << 1 : VNM_STRDB_CHUNK_MIN;
+        if(size > VNM_STRDB_CHUNK_MAX)
+            size = VNM_STRDB_CHUNK_MAX;
+        if(size < len)
+            size = len;
+        c = malloc(sizeof(vnm_strdb_chunk_t) + size);
+        c->next = d->chunks;
+        c->size = size;
+        c->used = 0;
+        d->chunks = c;
+    }
+    char* rv = &c->data[c->used];
+    c->used += len;
+    return rv;
+}
+
+static void chunks_free(vnm_strdb_t* d) {
+    vnm_strdb_chunk_t* c = d->chunks;
+    while(c) {
+        vnm_strdb_chunk_t* next = c->next;
+        free(c);
+        c = next;
+    }
+    d->chunks = NULL;
+}
+
 vnm_strdb_t* vnm_strdb_new(void) {
-    vnm_strdb_t* d = malloc(sizeof(vnm_strdb_t));
+    vnm_strdb_t* d = calloc(1, sizeof(vnm_strdb_t));
     d->alloc = 8;
     d->count = 1;
     d->strings = malloc(d->alloc * sizeof(vnm_str_t));
     // note index zero is reserved as the no-match case with a NULL zero-len string...
     d->strings[0].data = NULL;
     d->strings[0].len = 0;
+    index_grow(d);
     return d;
 }
 
 unsigned vnm_strdb_add(vnm_strdb_t* d, const char* str) {
     assert(d); assert(str);
+    assert(d->alloc); // not borrowed or finished
+
+    const unsigned hash = str_hash(str);
+    unsigned i = hash & d->index_mask;
+    while(d->index[i].idx) {
+        if(d->index[i].hash == hash && !strcmp(d->strings[d->index[i].idx].data, str))
+            return d->index[i].idx;
+        i = (i + 1U) & d->index_mask;
+    }
 
     if(d->count == d->alloc) {
         d->alloc <<= 1;
         d->strings = realloc(d->strings, d->alloc * sizeof(vnm_str_t));
+        index_grow(d);
     }
 
     const unsigned rv = d->count++;
     vnm_str_t* s = &d->strings[rv];
     s->len = strlen(str) + 1;
-    s->data = malloc(s->len);
+    s->data = chunk_alloc(d, s->len);
     memcpy(s->data, str, s->len);
+    index_insert(d, hash, rv);
 
     return rv;
 }
 
+void vnm_strdb_finish(vnm_strdb_t* d) {
+    assert(d);
+    assert(d->alloc); // not borrowed or finished
+
+    size_t arena_len = 0;
+    for(unsigned i = 1; i < d->count; i++)
+        arena_len += d->strings[i].len;
+
+    vnm_str_t* strings = malloc(d->count * sizeof(vnm_str_t) + (arena_len ? arena_len : 1U));
+    char* arena = (char*)&strings[d->count];
+    strings[0] = d->strings[0];
+    size_t off = 0;
+    for(unsigned i = 1; i < d->count; i++) {
+        const unsigned len = d->strings[i].len;
+        memcpy(&arena[off], d->strings[i].data, len);
+        strings[i].len = len;
+        strings[i].data = &arena[off];
+        off += len;
+    }
+
+    free(d->strings);
+    free(d->index);
+    chunks_free(d);
+    d->strings = strings;
+    d->alloc = 0;
+    d->index = NULL;
+    d->index_mask = 0;
+    d->arena = arena;
+    d->arena_len = arena_len;
+}
+
+const char* vnm_strdb_arena(const vnm_strdb_t* d, size_t* len_p) {
+    assert(d); assert(len_p);
+    *len_p = d->arena_len;
+    return d->arena;
+}
+
+vnm_strdb_t* vnm_strdb_new_borrowed(vnm_str_t* strings, const unsigned count, const char* arena, const size_t arena_len) {
+    assert(strings); assert(count);
+    assert(!strings[0].data && !strings[0].len);
+    vnm_strdb_t* d = calloc(1, sizeof(vnm_strdb_t));
+    d->borrowed = true;
+    d->count = count;
+    d->strings = strings;
+    d->arena = arena;
+    d->arena_len = arena_len;
+    return d;
+}
+
+vnm_strdb_t* vnm_strdb_snapshot(const vnm_strdb_t* d) {
+    assert(d);
+    vnm_str_t* strings = malloc(d->count * sizeof(vnm_str_t));
+    memcpy(strings, d->strings, d->count * sizeof(vnm_str_t));
+    return vnm_strdb_new_borrowed(strings, d->count, d->arena, d->arena_len);
+}
+
 const vnm_str_t* vnm_strdb_get(const vnm_strdb_t* d, const unsigned idx) {
     assert(d); assert(idx < d->count);
     return &d->strings[idx];
 }
 
+unsigned vnm_strdb_count(const vnm_strdb_t* d) {
+    assert(d);
+    return d->count;
+}
+
 void vnm_strdb_destroy(vnm_strdb_t* d) {
     assert(d);
-    for(unsigned i = 0; i < d->count; i++)
-        free(d->strings[i].data);
+    if(!d->borrowed) {
+        free(d->index);
+        chunks_free(d);
+    }
     free(d->strings);
     free(d);
 }
-
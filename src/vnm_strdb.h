@@ -1,6 +1,8 @@
 #ifndef VNM_STRDB_HDR
 #define VNM_STRDB_HDR
 
+#include <stddef.h>
+
 typedef struct {
     unsigned len; // includes NUL in length
     char* data; // NUL-terminated
@@ -9,9 +11,36 @@ typedef struct {
 struct _vnm_strdb;
 typedef struct _vnm_strdb vnm_strdb_t;
 
+// Strings are interned: adding one equal to an existing string returns
+//   the existing index.  While strings are being added, their data goes
+//   in chunks which never move, so pointers from vnm_strdb_get() (and
+//   snapshots) stay valid as the strdb grows.
 vnm_strdb_t* vnm_strdb_new(void);
 unsigned vnm_strdb_add(vnm_strdb_t* d, const char* str);
 const vnm_str_t* vnm_strdb_get(const vnm_strdb_t* d, const unsigned idx);
+unsigned vnm_strdb_count(const vnm_strdb_t* d);
+
+// Done adding: repacks the string table and all of the string data, in
+//   index order, into a single exact-sized allocation, and drops the
+//   intern table.  Earlier vnm_strdb_get() pointers become invalid, and no
+//   more strings can be added.
+void vnm_strdb_finish(vnm_strdb_t* d);
+
+// The contiguous string data of a finished or borrowed strdb, in which
+//   every string's data lies (NULL while strings can still be added).
+//   This is what vnm_bin_write() serializes as is.
+const char* vnm_strdb_arena(const vnm_strdb_t* d, size_t* len_p);
+
+// A read-only strdb over "count" strings owned by someone else (e.g. an
+//   mmap()), which vnm_strdb_destroy() won't free.  The strings array
+//   itself is taken over and freed, and index zero must be the no-match
+//   entry as in any other strdb.  "arena" is the string data they lie in,
+//   if known.
+vnm_strdb_t* vnm_strdb_new_borrowed(vnm_str_t* strings, const unsigned count, const char* arena, const size_t arena_len);
+
+// A borrowed strdb over the strings "d" holds right now, which stays valid
+//   while "d" lives even if more are added to it later.
+vnm_strdb_t* vnm_strdb_snapshot(const vnm_strdb_t* d);
 void vnm_strdb_destroy(vnm_strdb_t* d);
 
 #endif // VNM_STRDB_HDR
@@ -0,0 +1,189 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_log.h"
+#include "vnm_text.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "vnm_addr.h"
+
+typedef struct {
+    const char* fn;
+    vnm_strdb_t* strdb;
+    nlist_t* nl;
+    unsigned line;
+    // the previous line's key, as files are often grouped by key
+    char* last_key;
+    size_t last_len;
+    size_t last_alloc;
+    unsigned last_idx;
+} vt_t;
+
+bool vnm_text_detect(const char* fn) {
+    assert(fn);
+
+    FILE* fp = fopen(fn, "r");
+    if(!fp)
+        return false;
+    int c;
+    do {
+        c = getc(fp);
+    } while(c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    fclose(fp);
+    return c != EOF && c != '{' && c != '[';
+}
+
+static bool is_ws(const char c) {
+    return c == ' ' || c == '\t';
+}
+
+// The key's strdb index, reusing the previous line's if it's the same
+static unsigned vt_key(vt_t* vt, const char* key, const size_t len) {
+    if(vt->last_idx && len == vt->last_len && !memcmp(key, vt->last_key, len))
+        return vt->last_idx;
+
+    if(len >= vt->last_alloc) {
+        vt->last_alloc = len + 64U;
+        free(vt->last_key);
+        vt->last_key = malloc(vt->last_alloc);
+    }
+    memcpy(vt->last_key, key, len);
+    vt->last_len = len;
+    vt->last_idx = vnm_strdb_add(vt->strdb, key);
+    return vt->last_idx;
+}
+
+// One line from "p" to "end" (its newline, or the end of the data), which
+//   is overwritten with a NUL.  true retval means error (logged).
+static bool vt_line(vt_t* vt, char* p, char* end) {
+    if(memchr(p, '\0', (size_t)(end - p))) {
+        ERR("Text database '%s', line %u: NUL byte", vt->fn, vt->line);
+        return true;
+    }
+
+    // trim surrounding whitespace, including a CR
+    while(end > p && (is_ws(end[-1]) || end[-1] == '\r'))
+        end--;
+    *end = '\0';
+    while(is_ws(*p))
+        p++;
+    if(!*p || *p == '#')
+        return false;
+
+    char* net = p;
+    while(*p && !is_ws(*p))
+        p++;
+    if(!*p) {
+        ERR("Text database '%s', line %u: no key for '%s'", vt->fn, vt->line, net);
+        return true;
+    }
+    *p++ = '\0';
+    while(is_ws(*p))
+        p++;
+    const char* key = p;
+    for(const char* k = key; k < end; k++) {
+        if((uint8_t)*k < 0x20 || *k == 0x7F) {
+            ERR("Text database '%s', line %u: control character in key", vt->fn, vt->line);
+            return true;
+        }
+    }
+
+    unsigned mask;
+    uint8_t ipv6[16];
+    const char* why = vnm_net_parse(net, ipv6, &mask);
+    if(why) {
+        ERR("Text database '%s', line %u: '%s' %s", vt->fn, vt->line, net, why);
+        return true;
+    }
+
+    if(nlist_append(vt->nl, ipv6, mask, vt_key(vt, key, (size_t)(end - key))))
+        ERR("Text database '%s', line %u: '%s' has bits beyond the network mask, which were auto-cleared!", vt->fn, vt->line, net);
+
+    return false;
+}
+
+bool vnm_text_load(const char* fn, vnm_strdb_t* strdb, nlist_t* nl) {
+    assert(fn); assert(strdb); assert(nl);
+
+    FILE* fp = fopen(fn, "r");
+    if(!fp) {
+        ERR("Failed to open text database '%s': %s", fn, strerror(errno));
+        return true;
+    }
+
+    vt_t vt = {
+        .fn = fn,
+        .strdb = strdb,
+        .nl = nl,
+    };
+
+    // one spare byte, for a NUL after an unterminated last line
+    char* buf = malloc(VNM_TEXT_LINE_MAX + 1U);
+    size_t len = 0;
+    bool failed = false;
+    bool eof = false;
+    while(!failed && !eof) {
+        const size_t got = fread(&buf[len], 1, VNM_TEXT_LINE_MAX - len, fp);
+        if(got < VNM_TEXT_LINE_MAX - len) {
+            if(ferror(fp)) {
+                ERR("Text database '%s', line %u: read error: %s", fn, vt.line + 1U, strerror(errno));
+                failed = true;
+                break;
+            }
+            eof = true;
+        }
+        len += got;
+
+        // all the complete lines in the buffer, then the partial one is
+        //   moved up front for the next read
+        char* p = buf;
+        char* const end = &buf[len];
+        char* nl_p;
+        while(!failed && (nl_p = memchr(p, '\n', (size_t)(end - p)))) {
+            vt.line++;
+            failed = vt_line(&vt, p, nl_p);
+            p = nl_p + 1;
+        }
+        len = (size_t)(end - p);
+        if(failed || !len)
+            continue;
+
+        if(eof) {
+            vt.line++;
+            failed = vt_line(&vt, p, end);
+        }
+        else if(len == VNM_TEXT_LINE_MAX) {
+            ERR("Text database '%s', line %u: longer than %u bytes", fn, vt.line + 1U, VNM_TEXT_LINE_MAX - 1U);
+            failed = true;
+        }
+        else {
+            memmove(buf, p, len);
+        }
+    }
+
+    free(buf);
+    free(vt.last_key);
+    fclose(fp);
+    return failed;
+}
@@ -0,0 +1,58 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef VNM_TEXT_HDR
+#define VNM_TEXT_HDR
+
+#include "config.h"
+#include <stdbool.h>
+
+#include "vnm_strdb.h"
+#include "nlist.h"
+
+// The line-oriented text database format, one network and its key per
+//   line:
+//
+//   <network><TAB><key>
+//   # ...               comments and blank lines are ignored
+//
+// Networks are parsed as in JSON databases.  Any run of tabs and spaces
+//   separates the network from its key, which is the rest of the line
+//   with surrounding whitespace trimmed (so it may contain spaces, but no
+//   tabs or other control characters).  A CR before the newline is
+//   ignored, as is a missing newline on the last line.  Lines may be up
+//   to VNM_TEXT_LINE_MAX bytes, including the newline.
+//
+// The file is read through a fixed buffer in one pass, each network going
+//   straight into the nlist, so memory use doesn't depend on its size.
+
+#define VNM_TEXT_LINE_MAX 65536U
+
+// Whether "fn" looks like a text database rather than JSON: its first
+//   non-whitespace character is there and isn't '{' or '['.  This doesn't
+//   tell it from the other formats, which are detected first.
+bool vnm_text_detect(const char* fn);
+
+// Appends all the networks of "fn" to "nl", adding their keys to
+//   "strdb".  Errors are logged with their line number.  true retval
+//   means error.
+bool vnm_text_load(const char* fn, vnm_strdb_t* strdb, nlist_t* nl);
+
+#endif // VNM_TEXT_HDR
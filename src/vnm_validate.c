@@ -21,20 +21,59 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-o options] <input file> [ip address]\n", argv0);
+    fprintf(stderr, "       %s [-o build_threads=N,mmdb_key=PATH] -c <output file> <input file>\n", argv0);
+    exit(99);
+}
 
 int main(int argc, char* argv[]) {
-    if(argc != 2 && argc != 3) {
+    const char* options = NULL;
+    const char* compile_out = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "o:c:")) != -1) {
+        switch(opt) {
+            case 'o': options = optarg; break;
+            case 'c': compile_out = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+    if(argc != 1 && argc != 2) {
         fprintf(stderr,"Must specify an input file!\n");
         return 99;
     }
-    vnm_db_t* vdb = vnm_db_parse(argv[1], NULL);
+
+    vnm_opts_t opts;
+    if(vnm_opts_parse(options, &opts)) {
+        fprintf(stderr,"Bad options '%s'!\n", options);
+        return 97;
+    }
+
+    if(compile_out) {
+        if(argc != 1)
+            usage(argv[0]);
+        if(vnm_db_compile(argv[0], compile_out, &opts)) {
+            fprintf(stderr,"Compiling '%s' to '%s' failed!\n", argv[0], compile_out);
+            return 98;
+        }
+        fprintf(stderr,"OK\n");
+        return 0;
+    }
+
+    vnm_db_t* vdb = vnm_db_parse(argv[0], NULL, &opts);
     if(!vdb) {
-        fprintf(stderr,"Parsing '%s' failed!\n", argv[1]);
+        fprintf(stderr,"Parsing '%s' failed!\n", argv[0]);
         return 98;
     }
-    if(argc == 3) {
-        const vnm_str_t* str = vnm_lookup(vdb, argv[2]);
-        fprintf(stderr,"%s => %s\n", argv[2], str ? str->data : "<No-Match>");
+    if(argc == 2) {
+        const vnm_str_t* str = vnm_lookup(vdb, NULL, argv[1]);
+        fprintf(stderr,"%s => %s\n", argv[1], str ? str->data : "<No-Match>");
     }
     vnm_db_destruct(vdb);
     fprintf(stderr,"OK\n");
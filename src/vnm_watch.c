@@ -0,0 +1,152 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "vnm_watch.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+struct _vnm_watch {
+    char* dir;
+    char* names[2]; // of the database and delta files within dir
+    char* fns[2];   // and their full paths, NULL for no delta
+    int dir_wd;     // -1 while not watched
+    int file_wds[2];
+};
+
+vnm_watch_t* vnm_watch_new(const char* fn, const bool delta) {
+    assert(fn);
+
+    vnm_watch_t* w = calloc(1, sizeof(vnm_watch_t));
+    w->fns[0] = strdup(fn);
+    if(delta) {
+        const size_t fnlen = strlen(fn);
+        w->fns[1] = malloc(fnlen + 7);
+        memcpy(w->fns[1], fn, fnlen);
+        memcpy(&w->fns[1][fnlen], ".delta", 7);
+    }
+
+    const char* slash = strrchr(fn, '/');
+    if(slash) {
+        w->dir = strndup(fn, slash == fn ? 1 : (size_t)(slash - fn));
+        w->names[0] = strdup(slash + 1);
+    }
+    else {
+        w->dir = strdup(".");
+        w->names[0] = strdup(fn);
+    }
+    if(delta) {
+        const size_t namelen = strlen(w->names[0]);
+        w->names[1] = malloc(namelen + 7);
+        memcpy(w->names[1], w->names[0], namelen);
+        memcpy(&w->names[1][namelen], ".delta", 7);
+    }
+
+    w->dir_wd = -1;
+    w->file_wds[0] = w->file_wds[1] = -1;
+    return w;
+}
+
+unsigned vnm_watch_wds(const vnm_watch_t* w, int* wds) {
+    assert(w); assert(wds);
+    unsigned n = 0;
+    if(w->dir_wd >= 0)
+        wds[n++] = w->dir_wd;
+    for(unsigned i = 0; i < 2; i++)
+        if(w->file_wds[i] >= 0)
+            wds[n++] = w->file_wds[i];
+    return n;
+}
+
+void vnm_watch_destroy(vnm_watch_t* w) {
+    assert(w);
+    for(unsigned i = 0; i < 2; i++) {
+        free(w->names[i]);
+        free(w->fns[i]);
+    }
+    free(w->dir);
+    free(w);
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define VNM_WATCH_DIR_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE \
+    | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define VNM_WATCH_FILE_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+void vnm_watch_arm(vnm_watch_t* w, const int fd) {
+    assert(w);
+    if(fd < 0)
+        return;
+
+    if(w->dir_wd < 0)
+        w->dir_wd = inotify_add_watch(fd, w->dir, VNM_WATCH_DIR_MASK);
+
+    // a replaced file gets a new descriptor, the same one gets the same
+    for(unsigned i = 0; i < 2; i++)
+        if(w->fns[i])
+            w->file_wds[i] = inotify_add_watch(fd, w->fns[i], VNM_WATCH_FILE_MASK);
+}
+
+bool vnm_watch_event(vnm_watch_t* w, const int wd, const uint32_t mask, const char* name) {
+    assert(w);
+
+    bool rv = false;
+    if(wd == w->dir_wd) {
+        if(mask & IN_IGNORED) {
+            w->dir_wd = -1;
+            rv = true;
+        }
+        else if(mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+            rv = true;
+        }
+        else if(name) {
+            for(unsigned i = 0; i < 2; i++)
+                if(w->names[i] && !strcmp(name, w->names[i]))
+                    rv = true;
+        }
+    }
+
+    for(unsigned i = 0; i < 2; i++) {
+        if(wd == w->file_wds[i]) {
+            if(mask & IN_IGNORED)
+                w->file_wds[i] = -1;
+            rv = true;
+        }
+    }
+    return rv;
+}
+
+#else // HAVE_SYS_INOTIFY_H
+
+void vnm_watch_arm(vnm_watch_t* w, const int fd __attribute__((unused))) {
+    assert(w);
+}
+
+bool vnm_watch_event(vnm_watch_t* w, const int wd __attribute__((unused)), const uint32_t mask __attribute__((unused)), const char* name __attribute__((unused))) {
+    assert(w);
+    return false;
+}
+
+#endif // HAVE_SYS_INOTIFY_H
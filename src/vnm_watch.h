@@ -0,0 +1,62 @@
+/* Copyright © 2026 Brandon L Black <bblack@wikimedia.org>
+ *
+ * This file is part of libvmod-netmapper.
+ *
+ * libvmod-netmapper is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libvmod-netmapper is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libvmod-netmapper.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VNM_WATCH_HDR
+#define VNM_WATCH_HDR
+
+#include "config.h"
+#include <stdbool.h>
+#include <inttypes.h>
+
+// What to watch for changes to a database file, for the reload scheduler,
+//   which owns the one inotify instance that all the watches are added to
+//   (see vnm_sched.c).  With inotify, the file's directory is watched for
+//   anything touching the file by name (writes, renames into place,
+//   creation and removal), which covers both editor-style rewrites and
+//   atomic replacement, and the file itself is watched too, in case it's a
+//   symlink to elsewhere.  Without inotify (not built in, or it fails at
+//   runtime), nothing is armed and the scheduler's periodic stat() checks
+//   are all there is.
+
+struct _vnm_watch;
+typedef struct _vnm_watch vnm_watch_t;
+
+// "delta" also watches the database's delta file (see vnm_delta.h)
+vnm_watch_t* vnm_watch_new(const char* fn, const bool delta);
+
+// The most inotify watch descriptors a watch uses
+#define VNM_WATCH_WDS 3U
+
+// Adds whichever of the watch's inotify watches aren't in place to the
+//   inotify instance "fd", e.g. on a file that was missing, or which was
+//   replaced since.  Watches that are no longer in use are left for the
+//   caller to remove, as other watches on the same instance may share them.
+void vnm_watch_arm(vnm_watch_t* w, const int fd);
+
+// Fills "wds" with the watch descriptors currently in use, returns how many
+unsigned vnm_watch_wds(const vnm_watch_t* w, int* wds);
+
+// Whether an event from the inotify instance, on one of this watch's
+//   descriptors, is about the watched files.  An IN_IGNORED one also
+//   forgets its descriptor, to be re-armed.
+bool vnm_watch_event(vnm_watch_t* w, const int wd, const uint32_t mask, const char* name);
+
+void vnm_watch_destroy(vnm_watch_t* w);
+
+#endif // VNM_WATCH_HDR